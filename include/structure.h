@@ -2,16 +2,15 @@
 #include <GLFW/glfw3.h>
 #include <cglm/cglm.h>
 
-typedef struct
-{
-    float inPosition[3]; // Or use a vec3-like struct if you have one
-} Vertex;
+// Vertex is in src/myvertex.c, next to the functions that pack it
 
 typedef struct
 {
     float time;
     mat4 view;
     mat4 projection;
+    vec4 positionOffset; // dequantizes the drawn mesh's positions (PositionQuantization), xyz used
+    vec4 positionScale;
 } UBO;
 
 typedef struct
@@ -29,6 +28,7 @@ typedef struct
     int keyDeletePressed;
     int key1Pressed;
     int key2Pressed;
+    int keyTPressed;
 } KeyStates;
 
 typedef struct
@@ -53,3 +53,24 @@ typedef struct
     // Add more transformation fields as needed (e.g., translateZ, rotate, scale)
 } Transform;
 
+typedef struct
+{
+    uint32_t threadCount;    // command recording threads including the main thread, 0 picks one per core
+    uint32_t drawCount;      // 0 draws all instances in one call, n > 0 starts with n instances and one draw per instance
+    bool headless;           // render offscreen without a window, surface or swap chain
+    uint32_t frameCount;     // frames to render before exiting, 0 runs until the window closes (headless picks a default)
+    bool profile;            // time cpu stages and gpu passes, report min/avg/p95/p99 per region
+    const char *tracePath;   // record a chrome trace, written at exit and whenever T is pressed
+    double hitchThresholdMs; // frames slower than this count as hitches, 0 picks FRAME_STATS_DEFAULT_HITCH_MS
+    const char *csvPath;     // one row per frame: frame time, instances, draws, bytes uploaded
+    const char *modelPath;   // gltf every instance draws, "cube" for the built in cube
+    uint32_t instanceCount;  // instances to start with (laid out in a grid), 0 falls back to drawCount or 1
+    const char *resultsPath; // with --frames, one json object with load time and frame time percentiles at exit
+    const char *recordPath;  // log key state changes with their frame numbers
+    const char *replayPath;  // drive the keys from a recording instead of the keyboard
+    double timestepMs;       // simulation step while replaying, 0 picks 60 steps per second
+    bool verboseLoad;        // print every vertex and index while loading the gltf
+    bool directDraws;        // one vkCmdDrawIndexed per draw even when the device can draw indirect
+    bool syncLoad;           // load the model before the first frame instead of on the asset loader thread
+    bool quantizePositions;  // unorm16 positions in the mesh's bounding box (QuantizedVertex)
+} AppOptions;
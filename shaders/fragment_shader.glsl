@@ -1,8 +1,13 @@
 #version 450
 layout(location = 0) in vec3 fragPosition; // Input from vertex shader
+layout(location = 1) in vec3 fragNormal;
+layout(location = 2) in vec4 fragTangent; // for normal maps, nothing samples textures yet
+layout(location = 3) in vec2 fragUv;
 layout(location = 0) out vec4 outColor;   // Output color
 
 void main() {
     vec3 normPos = fragPosition * 0.5 + 0.5; // Normalize the position
-    outColor = vec4(normPos, 1.0);           // Output color based on position
+    vec3 lightDirection = normalize(vec3(0.4, 0.8, 0.6));
+    float diffuse = max(dot(normalize(fragNormal), lightDirection), 0.0);
+    outColor = vec4(normPos * (0.35 + 0.65 * diffuse), 1.0); // position colors, lit by one directional light
 }
@@ -4,15 +4,32 @@ layout(binding = 0) uniform UBO {
     float time;
     mat4 view;
     mat4 projection;
+    vec4 positionOffset; // position quantization of the mesh (src/myvertex.c), offset 0 and scale 1 for float positions
+    vec4 positionScale;
 } ubo;
 
-layout(location = 0) in vec3 inPosition;
+// packed vertex (src/myvertex.c), the formats in getVertexFormat turn the snorm16/float16 fields into floats
+layout(location = 0) in vec3 inPosition; // float, or unorm16 in the mesh's box with --quantize-positions
+layout(location = 5) in vec2 inNormal;  // octahedral
+layout(location = 6) in vec2 inTangent; // octahedral, bitangent sign in the sign of y
+layout(location = 7) in vec2 inUv;
 layout(location = 1) in vec4 inModelRow0;
 layout(location = 2) in vec4 inModelRow1;
 layout(location = 3) in vec4 inModelRow2;
 layout(location = 4) in vec4 inModelRow3;
 
 layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec4 fragTangent;
+layout(location = 3) out vec2 fragUv;
+
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-direction.z, 0.0);
+    direction.x += direction.x >= 0.0 ? -fold : fold;
+    direction.y += direction.y >= 0.0 ? -fold : fold;
+    return normalize(direction);
+}
 
 void main() {
     int speedFactor = 5;
@@ -31,10 +48,18 @@ void main() {
     modelMatrix = modelMatrix * rotationMatrix;
 
     // Transform the vertex position
-    vec4 worldPosition = modelMatrix * vec4(inPosition, 1.0);
+    vec3 position = ubo.positionOffset.xyz + ubo.positionScale.xyz * inPosition;
+    vec4 worldPosition = modelMatrix * vec4(position, 1.0);
     vec4 viewPosition = ubo.view * worldPosition;
     vec4 projectedPosition = ubo.projection * viewPosition;
 
+    // instances are only translated, rotated and uniformly scaled, so the model matrix works for directions too
+    float tangentSign = inTangent.y < 0.0 ? -1.0 : 1.0;
+    vec2 tangentEncoded = vec2(inTangent.x, abs(inTangent.y) * 2.0 - 1.0);
+    fragNormal = mat3(modelMatrix) * decodeOctahedral(inNormal);
+    fragTangent = vec4(mat3(modelMatrix) * decodeOctahedral(tangentEncoded), tangentSign);
+    fragUv = inUv;
+
     fragPosition = worldPosition.xyz;
     gl_Position = projectedPosition;
 }
@@ -2,24 +2,29 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include <vulkan/vulkan.h>
 
 #include "../include/structure.h"
+#include "myvertex.c"
 
+// 8 shared corners, so the normals point out of the corners. packed the way packNormal/packTangent/packHalf do it:
+// tangent +x, uv is xy mapped onto 0..1 (0x3c00 is 1.0 as a half)
 void createCubeVertexData(const Vertex **vertices, uint32_t *vertexCount) {
        static const Vertex cubeVertices[] = {
         // Front face
-        {{-0.5f, -0.5f, 0.5f}}, // Vertex 0
-        {{0.5f, -0.5f, 0.5f}},  // Vertex 1
-        {{0.5f, 0.5f, 0.5f}},   // Vertex 2
-        {{-0.5f, 0.5f, 0.5f}},  // Vertex 3
+        {{-0.5f, -0.5f, 0.5f}, {-10922, -10922}, {32767, 16384}, {0x0000, 0x0000}}, // Vertex 0
+        {{0.5f, -0.5f, 0.5f}, {10922, -10922}, {32767, 16384}, {0x3c00, 0x0000}},   // Vertex 1
+        {{0.5f, 0.5f, 0.5f}, {10922, 10922}, {32767, 16384}, {0x3c00, 0x3c00}},     // Vertex 2
+        {{-0.5f, 0.5f, 0.5f}, {-10922, 10922}, {32767, 16384}, {0x0000, 0x3c00}},   // Vertex 3
 
         // Back face
-        {{-0.5f, -0.5f, -0.5f}}, // Vertex 4
-        {{0.5f, -0.5f, -0.5f}},  // Vertex 5
-        {{0.5f, 0.5f, -0.5f}},   // Vertex 6
-        {{-0.5f, 0.5f, -0.5f}},  // Vertex 7
+        {{-0.5f, -0.5f, -0.5f}, {-21845, -21845}, {32767, 16384}, {0x0000, 0x0000}}, // Vertex 4
+        {{0.5f, -0.5f, -0.5f}, {21845, -21845}, {32767, 16384}, {0x3c00, 0x0000}},   // Vertex 5
+        {{0.5f, 0.5f, -0.5f}, {21845, 21845}, {32767, 16384}, {0x3c00, 0x3c00}},     // Vertex 6
+        {{-0.5f, 0.5f, -0.5f}, {-21845, 21845}, {32767, 16384}, {0x0000, 0x3c00}},   // Vertex 7
     };
     *vertexCount = sizeof(cubeVertices) / sizeof(cubeVertices[0]);
     *vertices = cubeVertices;
@@ -132,22 +137,12 @@ bool checkValidationLayerSupport()
     return layersAvailable;
 }
 
-void copyDataToDeviceMemory(VkDevice device, VkDeviceMemory deviceMemory, const void *data, VkDeviceSize size)
+// memProperties from vkGetPhysicalDeviceMemoryProperties, the gpu allocator queries them once and keeps them
+uint32_t findMemoryType(const VkPhysicalDeviceMemoryProperties *memProperties, uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
-    void *mappedMemory;
-    vkMapMemory(device, deviceMemory, 0, size, 0, &mappedMemory);
-    memcpy(mappedMemory, data, size);
-    vkUnmapMemory(device, deviceMemory);
-}
-
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    for (uint32_t i = 0; i < memProperties->memoryTypeCount; i++)
     {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        if ((typeFilter & (1 << i)) && (memProperties->memoryTypes[i].propertyFlags & properties) == properties)
         {
             return i;
         }
@@ -186,13 +181,162 @@ UserData *createUserData(uint32_t windowWidth, uint32_t windowHeight)
     return userData;
 }
 
-void printFPS(int *numFrames, double* lastTime, double currentTime){
-    *numFrames += 1;
-       if (currentTime - *lastTime >= 1.0)
-       { // If last print was more than 1 sec ago
-            printf("%f ms/frame, %d frames/sec\n", 1000.0 / *numFrames, *numFrames);
-            *numFrames = 0;
-            *lastTime += 1;
+static char *parseOptionString(int argc, char **argv, int *i)
+{
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "Missing value for option %s\n", argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+
+    *i += 1;
+    return argv[*i];
+}
+
+static uint32_t parseOptionValue(int argc, char **argv, int *i)
+{
+    char *end;
+    unsigned long value = strtoul(parseOptionString(argc, argv, i), &end, 10);
+    if (*end != '\0' || value > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid value %s for option %s\n", argv[*i], argv[*i - 1]);
+        exit(EXIT_FAILURE);
+    }
+    return (uint32_t)value;
+}
+
+static double parseOptionDouble(int argc, char **argv, int *i)
+{
+    char *end;
+    double value = strtod(parseOptionString(argc, argv, i), &end);
+    if (*end != '\0' || !(value > 0.0))
+    {
+        fprintf(stderr, "Invalid value %s for option %s\n", argv[*i], argv[*i - 1]);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+AppOptions parseAppOptions(int argc, char **argv)
+{
+    AppOptions options = {0};
+    options.modelPath = "./gltfs/testScene.gltf";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0)
+            options.threadCount = parseOptionValue(argc, argv, &i);
+        else if (strcmp(argv[i], "--draws") == 0)
+            options.drawCount = parseOptionValue(argc, argv, &i);
+        else if (strcmp(argv[i], "--headless") == 0)
+            options.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0)
+            options.frameCount = parseOptionValue(argc, argv, &i);
+        else if (strcmp(argv[i], "--profile") == 0)
+            options.profile = true;
+        else if (strcmp(argv[i], "--trace") == 0)
+            options.tracePath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--hitch-ms") == 0)
+            options.hitchThresholdMs = parseOptionDouble(argc, argv, &i);
+        else if (strcmp(argv[i], "--csv") == 0)
+            options.csvPath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--model") == 0)
+            options.modelPath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--instances") == 0)
+            options.instanceCount = parseOptionValue(argc, argv, &i);
+        else if (strcmp(argv[i], "--results") == 0)
+            options.resultsPath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--record") == 0)
+            options.recordPath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--replay") == 0)
+            options.replayPath = parseOptionString(argc, argv, &i);
+        else if (strcmp(argv[i], "--timestep-ms") == 0)
+            options.timestepMs = parseOptionDouble(argc, argv, &i);
+        else if (strcmp(argv[i], "--verbose-load") == 0)
+            options.verboseLoad = true;
+        else if (strcmp(argv[i], "--direct-draws") == 0)
+            options.directDraws = true;
+        else if (strcmp(argv[i], "--sync-load") == 0)
+            options.syncLoad = true;
+        else if (strcmp(argv[i], "--quantize-positions") == 0)
+            options.quantizePositions = true;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            fprintf(stderr, "usage: %s [--threads n] [--draws n] [--headless] [--frames n] [--profile] [--trace file.json] [--hitch-ms ms] [--csv file.csv]\n"
+                            "       [--model file.gltf|cube] [--instances n] [--results file.json]\n"
+                            "       [--record input.bin | --replay input.bin [--timestep-ms ms]] [--verbose-load] [--direct-draws] [--sync-load]\n"
+                            "       [--quantize-positions]\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-    // printf("lasttime %f\n", *lastTime);
-}
\ No newline at end of file
+    }
+
+    return options;
+}
+
+// monotonic wall clock in seconds, works without glfw (worker threads, headless runs)
+double getTimeSeconds()
+{
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct
+{
+    uint32_t frameCount;
+    double totalSeconds;
+    double min, avg, p50, p95, p99, max; // seconds
+} FrameTimeSummary;
+
+// min/avg/percentiles/max of a run's frame times (seconds), sorts frameTimes in place
+FrameTimeSummary summarizeFrameTimes(double *frameTimes, uint32_t frameCount, double totalSeconds)
+{
+    FrameTimeSummary summary = {0};
+    summary.frameCount = frameCount;
+    summary.totalSeconds = totalSeconds;
+    if (frameCount == 0)
+        return summary;
+
+    qsort(frameTimes, frameCount, sizeof(double), compareDoubles);
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        sum += frameTimes[i];
+    }
+
+    summary.min = frameTimes[0];
+    summary.avg = sum / frameCount;
+    summary.p50 = frameTimes[frameCount / 2];
+    summary.p95 = frameTimes[(uint32_t)(frameCount * 0.95)];
+    summary.p99 = frameTimes[(uint32_t)(frameCount * 0.99)];
+    summary.max = frameTimes[frameCount - 1];
+    return summary;
+}
+
+void printFrameTimeSummary(const FrameTimeSummary *summary)
+{
+    if (summary->frameCount == 0)
+        return;
+
+    printf("%u frames in %.3f s, %.1f frames/sec\n", summary->frameCount, summary->totalSeconds, summary->frameCount / summary->totalSeconds);
+    printf("frame time ms: min %.3f avg %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+           summary->min * 1000.0,
+           summary->avg * 1000.0,
+           summary->p50 * 1000.0,
+           summary->p95 * 1000.0,
+           summary->p99 * 1000.0,
+           summary->max * 1000.0);
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mystaging.c"
+#include "mythreads.c"
+
+// background model loading: a loader thread runs loadModel (mygltf.c, included before this file) with its own
+// thread pool and its own staging ring on the transfer queue, so parsing, extraction and uploads never stall a frame.
+// requests go in under a mutex, finished meshes come back through a single producer/single consumer ring the render
+// loop polls once per frame without locking. the gpu allocator is shared, it locks internally.
+
+#define ASSET_LOADER_MAX_PENDING 8 // requested and not yet polled, bounds both queues
+
+typedef struct
+{
+    char path[1024];
+    bool verbose;
+    bool quantizePositions;
+} AssetRequest;
+
+typedef struct
+{
+    Mesh mesh;
+    char path[1024];
+    double seconds; // from the request to the end of the uploads
+} LoadedModel;
+
+typedef struct
+{
+    GpuAllocator *allocator;
+    StagingRing *stagingRing; // on the transfer queue, only the loader thread touches it
+    ThreadPool *threadPool;
+    uint32_t queueFamilyIndex;
+    uint32_t graphicsQueueFamilyIndex; // buffers are released to this family when the two differ
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t requestReady;
+    AssetRequest requests[ASSET_LOADER_MAX_PENDING];
+    double requestTimes[ASSET_LOADER_MAX_PENDING];
+    uint32_t firstRequest;
+    uint32_t requestCount;
+    bool shuttingDown;
+
+    // completion ring: the loader thread owns tail, the render thread owns head
+    LoadedModel completions[ASSET_LOADER_MAX_PENDING];
+    _Atomic uint32_t completionHead;
+    _Atomic uint32_t completionTail;
+
+    uint32_t pendingCount; // render thread only, requested minus polled
+} AssetLoader;
+
+static void pushLoadedModel(AssetLoader *loader, const LoadedModel *model)
+{
+    // never full, requestModelLoad keeps at most ASSET_LOADER_MAX_PENDING models outstanding
+    uint32_t tail = atomic_load_explicit(&loader->completionTail, memory_order_relaxed);
+    loader->completions[tail % ASSET_LOADER_MAX_PENDING] = *model;
+    atomic_store_explicit(&loader->completionTail, tail + 1, memory_order_release);
+}
+
+static void *assetLoaderThread(void *argument)
+{
+    AssetLoader *loader = argument;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&loader->mutex);
+        while (!loader->shuttingDown && loader->requestCount == 0)
+            pthread_cond_wait(&loader->requestReady, &loader->mutex);
+
+        if (loader->shuttingDown)
+        {
+            pthread_mutex_unlock(&loader->mutex);
+            break;
+        }
+
+        AssetRequest request = loader->requests[loader->firstRequest];
+        double requestTime = loader->requestTimes[loader->firstRequest];
+        loader->firstRequest = (loader->firstRequest + 1) % ASSET_LOADER_MAX_PENDING;
+        loader->requestCount--;
+        pthread_mutex_unlock(&loader->mutex);
+
+        LoadedModel model = {0};
+        snprintf(model.path, sizeof(model.path), "%s", request.path);
+        loadModel(request.path, request.verbose, request.quantizePositions, loader->threadPool, loader->allocator, loader->stagingRing, &model.mesh);
+
+        // hand the buffers over to the graphics family, then wait for the copies so the mesh is complete when it is polled
+        stagingRingReleaseBuffer(loader->stagingRing, model.mesh.vertexBuffer, loader->graphicsQueueFamilyIndex);
+        stagingRingReleaseBuffer(loader->stagingRing, model.mesh.indexBuffer, loader->graphicsQueueFamilyIndex);
+        stagingRingFlush(loader->stagingRing);
+
+        model.seconds = getTimeSeconds() - requestTime;
+        pushLoadedModel(loader, &model);
+    }
+
+    return NULL;
+}
+
+// queue is the transfer queue from createLogicalDevice. threadCount 0 picks half the processors, the other half
+// keeps recording frames
+AssetLoader *createAssetLoader(GpuAllocator *allocator, uint32_t queueFamilyIndex, VkQueue queue, uint32_t graphicsQueueFamilyIndex, uint32_t threadCount)
+{
+    AssetLoader *loader = calloc(1, sizeof(AssetLoader));
+    if (!loader)
+    {
+        fprintf(stderr, "Failed to allocate the asset loader\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (threadCount == 0)
+        threadCount = getProcessorCount() > 1 ? getProcessorCount() / 2 : 1;
+
+    loader->allocator = allocator;
+    loader->queueFamilyIndex = queueFamilyIndex;
+    loader->graphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+    loader->stagingRing = createStagingRing(allocator, queueFamilyIndex, queue, STAGING_RING_DEFAULT_SIZE);
+    loader->threadPool = createThreadPool(threadCount - 1); // the loader thread works in its own pool
+    atomic_init(&loader->completionHead, 0);
+    atomic_init(&loader->completionTail, 0);
+
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->requestReady, NULL);
+    if (pthread_create(&loader->thread, NULL, assetLoaderThread, loader) != 0)
+    {
+        fprintf(stderr, "Failed to create the asset loader thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return loader;
+}
+
+// false when ASSET_LOADER_MAX_PENDING models are already on their way, poll some first
+bool requestModelLoad(AssetLoader *loader, const char *path, bool verbose, bool quantizePositions)
+{
+    if (loader->pendingCount == ASSET_LOADER_MAX_PENDING)
+        return false;
+    loader->pendingCount++;
+
+    pthread_mutex_lock(&loader->mutex);
+    uint32_t slot = (loader->firstRequest + loader->requestCount) % ASSET_LOADER_MAX_PENDING;
+    snprintf(loader->requests[slot].path, sizeof(loader->requests[slot].path), "%s", path);
+    loader->requests[slot].verbose = verbose;
+    loader->requests[slot].quantizePositions = quantizePositions;
+    loader->requestTimes[slot] = getTimeSeconds();
+    loader->requestCount++;
+    pthread_cond_signal(&loader->requestReady);
+    pthread_mutex_unlock(&loader->mutex);
+    return true;
+}
+
+// render thread, once per frame: takes one finished model if there is one. its buffers still belong to the transfer
+// family, stagingRingAcquireBuffer on the ring whose batch goes out ahead of the first draw that uses them
+bool pollLoadedModel(AssetLoader *loader, LoadedModel *model)
+{
+    uint32_t head = atomic_load_explicit(&loader->completionHead, memory_order_relaxed);
+    if (head == atomic_load_explicit(&loader->completionTail, memory_order_acquire))
+        return false;
+
+    *model = loader->completions[head % ASSET_LOADER_MAX_PENDING];
+    atomic_store_explicit(&loader->completionHead, head + 1, memory_order_release);
+    loader->pendingCount--;
+    return true;
+}
+
+// waits for the model being loaded right now, drops requests that have not started and destroys finished models
+// nobody polled. has to run before vkDeviceWaitIdle, the loader submits to its own queue
+void destroyAssetLoader(AssetLoader *loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->shuttingDown = true;
+    pthread_cond_signal(&loader->requestReady);
+    pthread_mutex_unlock(&loader->mutex);
+    pthread_join(loader->thread, NULL);
+
+    LoadedModel model;
+    while (pollLoadedModel(loader, &model))
+    {
+        destroyMesh(loader->allocator, &model.mesh);
+    }
+
+    destroyStagingRing(loader->stagingRing);
+    destroyThreadPool(loader->threadPool);
+    pthread_cond_destroy(&loader->requestReady);
+    pthread_mutex_destroy(&loader->mutex);
+    free(loader);
+}
@@ -0,0 +1,491 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "helpers.c"
+#include "mythreads.c"
+#include "myprofiler.c"
+
+// command recording: the draw list of a frame is split into contiguous chunks, each chunk is recorded into a
+// secondary command buffer by one thread of the pool and the primary buffer only runs the render pass and
+// vkCmdExecuteCommands. every (frame in flight, thread) pair owns its command pool, so pools are reset whole
+// once the frame's fence signalled and no two threads ever touch the same pool.
+// secondary buffers are kept per frame in flight and only re-recorded when the draw structure changes
+// (draw list, buffers, pipeline, descriptor set, extent). per frame data lives in the UBO and instance buffer
+// contents, so a static scene only re-records the tiny primary buffer that picks this frame's framebuffer.
+
+#define COMMAND_RECORDER_MIN_DRAWS_PER_THREAD 256 // below this a chunk is not worth waking a thread for
+
+// a run of indices of one index type that draws one primitive. index buffers keep all 16-bit indices in front
+// and all 32-bit indices behind them, firstIndex counts from the start of the range's own section
+typedef struct
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    VkIndexType indexType; // VK_INDEX_TYPE_UINT16 or VK_INDEX_TYPE_UINT32
+} DrawRange;
+
+typedef struct
+{
+    VkDrawIndexedIndirectCommand *draws; // 16-bit draws first, then the 32-bit ones
+    uint32_t drawCount;
+    uint32_t uint16DrawCount; // draws [0, uint16DrawCount) use 16-bit indices
+    uint32_t capacity;
+    uint64_t version; // bumped whenever the draws change, recorded command buffers compare against it
+
+    // inputs the list was built from
+    const DrawRange *ranges;
+    uint32_t rangeCount;
+    uint32_t instanceCount;
+    bool drawPerInstance;
+} DrawList;
+
+// everything needed to record the draws of one frame
+typedef struct
+{
+    VkRenderPass renderPass;
+    VkFramebuffer framebuffer;
+    VkExtent2D extent;
+    VkPipeline pipeline;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorSet descriptorSet;
+    VkBuffer vertexBuffer;
+    VkBuffer indexBuffer;
+    VkDeviceSize indexOffsets[2]; // where the 16-bit and the 32-bit indices start
+    VkBuffer instanceBuffer;
+    VkDeviceSize instanceBufferOffset;
+    const VkDrawIndexedIndirectCommand *draws;
+    uint32_t drawCount;
+    uint32_t uint16DrawCount;
+    uint64_t drawListVersion;
+    VkBuffer indirectBuffer; // holds draws at indirectBufferOffset, VK_NULL_HANDLE records one vkCmdDrawIndexed per draw
+    VkDeviceSize indirectBufferOffset;
+} DrawState;
+
+// what a frame's secondary buffers were recorded with, the framebuffer is left out since they inherit none
+typedef struct
+{
+    bool valid;
+    uint32_t chunkCount;
+    VkRenderPass renderPass;
+    VkExtent2D extent;
+    VkPipeline pipeline;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorSet descriptorSet;
+    VkBuffer vertexBuffer;
+    VkBuffer indexBuffer;
+    VkDeviceSize indexOffsets[2];
+    VkBuffer instanceBuffer;
+    VkDeviceSize instanceBufferOffset;
+    const VkDrawIndexedIndirectCommand *draws;
+    uint32_t drawCount;
+    uint32_t uint16DrawCount;
+    uint64_t drawListVersion;
+    VkBuffer indirectBuffer;
+    VkDeviceSize indirectBufferOffset;
+} RecordedDraws;
+
+typedef struct
+{
+    VkDevice device;
+    ThreadPool *threadPool;
+    uint32_t threadCount; // recording threads, the pool's workers plus the calling thread
+    uint32_t frameCount;
+    VkCommandPool *commandPools;       // [frame * threadCount + thread]
+    VkCommandBuffer *secondaryBuffers; // one secondary buffer per command pool
+    RecordedDraws *recordedDraws;      // per frame in flight, what its secondary buffers hold right now
+
+    // what the workers record during recordFrameCommands
+    const DrawState *drawState;
+    uint32_t frame;
+    uint32_t chunkCount;
+    uint32_t drawsPerChunk;
+
+    // cpu time spent recording, reset by printCommandRecorderStats
+    double recordSeconds;
+    uint32_t submittedFrames;
+    uint32_t rerecordedFrames;
+    uint64_t submittedDraws;
+} CommandRecorder;
+
+CommandRecorder *createCommandRecorder(VkDevice device, uint32_t queueFamilyIndex, uint32_t threadCount, uint32_t frameCount)
+{
+    CommandRecorder *recorder = calloc(1, sizeof(CommandRecorder));
+    if (!recorder)
+    {
+        fprintf(stderr, "Failed to allocate command recorder\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (threadCount == 0)
+        threadCount = getProcessorCount();
+
+    recorder->device = device;
+    recorder->threadCount = threadCount;
+    recorder->frameCount = frameCount;
+    recorder->threadPool = createThreadPool(threadCount - 1);
+
+    uint32_t poolCount = threadCount * frameCount;
+    recorder->commandPools = malloc(sizeof(VkCommandPool) * poolCount);
+    recorder->secondaryBuffers = malloc(sizeof(VkCommandBuffer) * poolCount);
+    recorder->recordedDraws = calloc(frameCount, sizeof(RecordedDraws));
+
+    // transient pools without per buffer reset, the whole pool is reset once per use
+    VkCommandPoolCreateInfo poolInfo = {0};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    for (uint32_t i = 0; i < poolCount; i++)
+    {
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &recorder->commandPools[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create recording command pool\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkCommandBufferAllocateInfo allocInfo = {0};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = recorder->commandPools[i];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &recorder->secondaryBuffers[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate secondary command buffer\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("command recording on %u threads\n", threadCount);
+    return recorder;
+}
+
+void destroyCommandRecorder(CommandRecorder *recorder)
+{
+    destroyThreadPool(recorder->threadPool);
+
+    // destroying a pool frees its command buffers
+    for (uint32_t i = 0; i < recorder->threadCount * recorder->frameCount; i++)
+    {
+        vkDestroyCommandPool(recorder->device, recorder->commandPools[i], NULL);
+    }
+    free(recorder->commandPools);
+    free(recorder->secondaryBuffers);
+    free(recorder->recordedDraws);
+    free(recorder);
+}
+
+static uint32_t appendRangeDraws(DrawList *list, uint32_t drawCount, const DrawRange *range, uint32_t instanceCount, bool drawPerInstance)
+{
+    if (!drawPerInstance)
+    {
+        list->draws[drawCount++] = (VkDrawIndexedIndirectCommand){range->indexCount, instanceCount, range->firstIndex, range->vertexOffset, 0};
+        return drawCount;
+    }
+
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        list->draws[drawCount++] = (VkDrawIndexedIndirectCommand){range->indexCount, 1, range->firstIndex, range->vertexOffset, i};
+    }
+    return drawCount;
+}
+
+// rebuilds the draw list when its inputs changed: per range one draw covering every instance, or one draw per instance.
+// draws of 16-bit ranges go first so a chunk rebinds the index buffer at most once
+void updateDrawList(DrawList *list, const DrawRange *ranges, uint32_t rangeCount, uint32_t instanceCount, bool drawPerInstance)
+{
+    if (list->version > 0 && list->ranges == ranges && list->rangeCount == rangeCount && list->instanceCount == instanceCount && list->drawPerInstance == drawPerInstance)
+        return;
+
+    uint32_t drawCount = rangeCount * (drawPerInstance ? instanceCount : 1);
+
+    if (drawCount > list->capacity)
+    {
+        list->capacity = drawCount > list->capacity * 2 ? drawCount : list->capacity * 2;
+        list->draws = realloc(list->draws, sizeof(VkDrawIndexedIndirectCommand) * list->capacity);
+        if (!list->draws)
+        {
+            fprintf(stderr, "Failed to grow draw list\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    drawCount = 0;
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        if (ranges[i].indexType == VK_INDEX_TYPE_UINT16)
+            drawCount = appendRangeDraws(list, drawCount, &ranges[i], instanceCount, drawPerInstance);
+    }
+    list->uint16DrawCount = drawCount;
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        if (ranges[i].indexType != VK_INDEX_TYPE_UINT16)
+            drawCount = appendRangeDraws(list, drawCount, &ranges[i], instanceCount, drawPerInstance);
+    }
+
+    list->drawCount = drawCount;
+    list->ranges = ranges;
+    list->rangeCount = rangeCount;
+    list->instanceCount = instanceCount;
+    list->drawPerInstance = drawPerInstance;
+    list->version++;
+}
+
+void destroyDrawList(DrawList *list)
+{
+    free(list->draws);
+    *list = (DrawList){0};
+}
+
+// binds the frame's state and records draws [firstDraw, firstDraw + drawCount) into a secondary buffer
+static void recordDrawCommands(VkCommandBuffer commandBuffer, const DrawState *state, uint32_t firstDraw, uint32_t drawCount)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state->pipeline);
+
+    // dynamic state is not inherited by secondary buffers, every chunk sets its own
+    VkViewport viewport = {0.0f, 0.0f, (float)state->extent.width, (float)state->extent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, state->extent};
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkBuffer vertexBuffers[] = {state->vertexBuffer, state->instanceBuffer};
+    VkDeviceSize offsets[] = {0, state->instanceBufferOffset}; // instance data starts at this frame's slice
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state->pipelineLayout, 0, 1, &state->descriptorSet, 0, NULL);
+
+    // with an indirect buffer the 16-bit draws and the 32-bit draws are one multi draw each
+    if (state->indirectBuffer != VK_NULL_HANDLE)
+    {
+        uint32_t endDraw = firstDraw + drawCount;
+        uint32_t split = state->uint16DrawCount < firstDraw ? firstDraw : state->uint16DrawCount > endDraw ? endDraw : state->uint16DrawCount;
+        VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+
+        if (split > firstDraw)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, state->indexBuffer, state->indexOffsets[0], VK_INDEX_TYPE_UINT16);
+            vkCmdDrawIndexedIndirect(commandBuffer, state->indirectBuffer, state->indirectBufferOffset + firstDraw * stride, split - firstDraw, (uint32_t)stride);
+        }
+        if (endDraw > split)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, state->indexBuffer, state->indexOffsets[1], VK_INDEX_TYPE_UINT32);
+            vkCmdDrawIndexedIndirect(commandBuffer, state->indirectBuffer, state->indirectBufferOffset + split * stride, endDraw - split, (uint32_t)stride);
+        }
+        return;
+    }
+
+    // the index buffer is bound at the section of the draw's index type, draws are sorted so this switches at most once
+    bool wideBound = false;
+    for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++)
+    {
+        bool wide = i >= state->uint16DrawCount;
+        if (i == firstDraw || wide != wideBound)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, state->indexBuffer, state->indexOffsets[wide], wide ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+            wideBound = wide;
+        }
+
+        const VkDrawIndexedIndirectCommand *draw = &state->draws[i];
+        vkCmdDrawIndexed(commandBuffer, draw->indexCount, draw->instanceCount, draw->firstIndex, draw->vertexOffset, draw->firstInstance);
+    }
+}
+
+static void recordDrawChunk(void *userData, uint32_t chunk)
+{
+    CommandRecorder *recorder = userData;
+    const DrawState *state = recorder->drawState;
+    traceBegin("record chunk");
+
+    uint32_t poolIndex = recorder->frame * recorder->threadCount + chunk;
+    VkCommandBuffer commandBuffer = recorder->secondaryBuffers[poolIndex];
+
+    // the frame's fence has been waited on, nothing recorded from this pool is still executing
+    vkResetCommandPool(recorder->device, recorder->commandPools[poolIndex], 0);
+
+    // no framebuffer: the buffer is reused with whichever swap chain image the frame acquires
+    VkCommandBufferInheritanceInfo inheritanceInfo = {0};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = state->renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+    // not one time submit, the frame executes it again until the draw structure changes
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin secondary command buffer %u\n", chunk);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t firstDraw = chunk * recorder->drawsPerChunk;
+    uint32_t drawCount = state->drawCount - firstDraw < recorder->drawsPerChunk ? state->drawCount - firstDraw : recorder->drawsPerChunk;
+    recordDrawCommands(commandBuffer, state, firstDraw, drawCount);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to end secondary command buffer %u\n", chunk);
+        exit(EXIT_FAILURE);
+    }
+    traceEnd("record chunk");
+}
+
+static RecordedDraws describeRecordedDraws(const DrawState *state, uint32_t chunkCount)
+{
+    RecordedDraws recorded = {0};
+    recorded.valid = true;
+    recorded.chunkCount = chunkCount;
+    recorded.renderPass = state->renderPass;
+    recorded.extent = state->extent;
+    recorded.pipeline = state->pipeline;
+    recorded.pipelineLayout = state->pipelineLayout;
+    recorded.descriptorSet = state->descriptorSet;
+    recorded.vertexBuffer = state->vertexBuffer;
+    recorded.indexBuffer = state->indexBuffer;
+    recorded.indexOffsets[0] = state->indexOffsets[0];
+    recorded.indexOffsets[1] = state->indexOffsets[1];
+    recorded.uint16DrawCount = state->uint16DrawCount;
+    recorded.instanceBuffer = state->instanceBuffer;
+    recorded.instanceBufferOffset = state->instanceBufferOffset;
+    recorded.draws = state->draws;
+    recorded.drawCount = state->drawCount;
+    recorded.drawListVersion = state->drawListVersion;
+    recorded.indirectBuffer = state->indirectBuffer;
+    recorded.indirectBufferOffset = state->indirectBufferOffset;
+    return recorded;
+}
+
+static bool sameRecordedDraws(const RecordedDraws *a, const RecordedDraws *b)
+{
+    return a->valid && b->valid &&
+           a->chunkCount == b->chunkCount &&
+           a->renderPass == b->renderPass &&
+           a->extent.width == b->extent.width && a->extent.height == b->extent.height &&
+           a->pipeline == b->pipeline &&
+           a->pipelineLayout == b->pipelineLayout &&
+           a->descriptorSet == b->descriptorSet &&
+           a->vertexBuffer == b->vertexBuffer &&
+           a->indexBuffer == b->indexBuffer &&
+           a->indexOffsets[0] == b->indexOffsets[0] &&
+           a->indexOffsets[1] == b->indexOffsets[1] &&
+           a->uint16DrawCount == b->uint16DrawCount &&
+           a->instanceBuffer == b->instanceBuffer &&
+           a->instanceBufferOffset == b->instanceBufferOffset &&
+           a->draws == b->draws &&
+           a->drawCount == b->drawCount &&
+           a->drawListVersion == b->drawListVersion &&
+           a->indirectBuffer == b->indirectBuffer &&
+           a->indirectBufferOffset == b->indirectBufferOffset;
+}
+
+// forgets what every frame recorded, the next recordFrameCommands of each frame records from scratch
+void invalidateRecordedCommands(CommandRecorder *recorder)
+{
+    for (uint32_t i = 0; i < recorder->frameCount; i++)
+    {
+        recorder->recordedDraws[i].valid = false;
+    }
+}
+
+// records the primary command buffer of frame. the draws live in the frame's secondary buffers, which are
+// recorded (in parallel when there are enough draws) only if the draw structure differs from last time.
+// profiler may be NULL, otherwise the frame and the render pass get gpu timestamp scopes
+void recordFrameCommands(CommandRecorder *recorder, uint32_t frame, VkCommandBuffer commandBuffer, const DrawState *state, Profiler *profiler)
+{
+    double startTime = getTimeSeconds();
+
+    // one chunk per COMMAND_RECORDER_MIN_DRAWS_PER_THREAD draws, at most one per thread
+    uint32_t chunkCount = (state->drawCount + COMMAND_RECORDER_MIN_DRAWS_PER_THREAD - 1) / COMMAND_RECORDER_MIN_DRAWS_PER_THREAD;
+    if (chunkCount > recorder->threadCount)
+        chunkCount = recorder->threadCount;
+    if (chunkCount == 0 || state->indirectBuffer != VK_NULL_HANDLE)
+        chunkCount = 1; // indirect draws are at most two commands, nothing to spread
+
+    RecordedDraws wanted = describeRecordedDraws(state, chunkCount);
+    if (!sameRecordedDraws(&recorder->recordedDraws[frame], &wanted))
+    {
+        recorder->drawState = state;
+        recorder->frame = frame;
+        recorder->chunkCount = chunkCount;
+        recorder->drawsPerChunk = (state->drawCount + chunkCount - 1) / chunkCount;
+
+        if (chunkCount > 1)
+            threadPoolRun(recorder->threadPool, chunkCount, recordDrawChunk, recorder);
+        else
+            recordDrawChunk(recorder, 0);
+
+        recorder->drawState = NULL;
+        recorder->recordedDraws[frame] = wanted;
+        recorder->rerecordedFrames++;
+    }
+
+    // only called after the frame's fence was waited on, so the gpu is done with this command buffer
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = NULL;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording command buffer for frame %u\n", frame);
+        exit(EXIT_FAILURE);
+    }
+
+    beginGpuFrame(profiler, commandBuffer, frame);
+    uint32_t frameScope = beginGpuScope(profiler, commandBuffer, frame, PROFILE_FRAME);
+    uint32_t passScope = beginGpuScope(profiler, commandBuffer, frame, PROFILE_MAIN_PASS);
+
+    // Begin render pass
+    VkRenderPassBeginInfo renderPassInfo = {0};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = state->renderPass;
+    renderPassInfo.framebuffer = state->framebuffer;
+    renderPassInfo.renderArea.offset = (VkOffset2D){0, 0};
+    renderPassInfo.renderArea.extent = state->extent;
+
+    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearColor;
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(commandBuffer, chunkCount, &recorder->secondaryBuffers[frame * recorder->threadCount]);
+    vkCmdEndRenderPass(commandBuffer);
+
+    endGpuScope(profiler, commandBuffer, frame, passScope);
+    endGpuScope(profiler, commandBuffer, frame, frameScope);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to end recording command buffer for frame %u\n", frame);
+        exit(EXIT_FAILURE);
+    }
+
+    recorder->recordSeconds += getTimeSeconds() - startTime;
+    recorder->submittedFrames++;
+    recorder->submittedDraws += state->drawCount;
+}
+
+void printCommandRecorderStats(CommandRecorder *recorder)
+{
+    if (recorder->submittedFrames == 0)
+        return;
+
+    printf("recording: %.3f ms/frame, %llu draws/frame on %u threads, %u of %u frames re-recorded\n",
+           1000.0 * recorder->recordSeconds / recorder->submittedFrames,
+           (unsigned long long)(recorder->submittedDraws / recorder->submittedFrames),
+           recorder->threadCount, recorder->rerecordedFrames, recorder->submittedFrames);
+
+    recorder->recordSeconds = 0.0;
+    recorder->submittedFrames = 0;
+    recorder->rerecordedFrames = 0;
+    recorder->submittedDraws = 0;
+}
@@ -1,3 +1,4 @@
+#include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 #include <cglm/cglm.h>
 
@@ -43,6 +44,8 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
         keyStates->key1Pressed = (action != GLFW_RELEASE);
     if (key == GLFW_KEY_2)
         keyStates->key2Pressed = (action != GLFW_RELEASE);
+    if (key == GLFW_KEY_T)
+        keyStates->keyTPressed = (action != GLFW_RELEASE);
 }
 
 void framebufferResizeCallback(GLFWwindow *window, int width, int height)
@@ -78,19 +81,13 @@ GLFWwindow *createWindow(uint32_t windowWidth, uint32_t windowHeight)
     return window;
 }
 
-void handleWindowResize(UserData *userData, mat4 *projection)
+// rebuilds the projection for a new swap chain extent, keeps the same fov and clip planes as main
+void updateProjectionForExtent(mat4 projection, VkExtent2D extent)
 {
-    if (userData && userData->windowData.wasResized)
-    {
-        int width = userData->windowData.width;
-        int height = userData->windowData.height;
-        float aspectRatio = (float)width / (float)height;
-
-        glm_perspective(glm_rad(45.0f), aspectRatio, 0.1f, 10.0f, *projection);
+    float aspectRatio = (float)extent.width / (float)extent.height;
 
-        // Reapply the Y-axis inversion for Vulkan
-        (*projection)[1][1] *= -1;
+    glm_perspective(glm_rad(45.0f), aspectRatio, 0.1f, 10.0f, projection);
 
-        userData->windowData.wasResized = false;
-    }
+    // Reapply the Y-axis inversion for Vulkan
+    projection[1][1] *= -1;
 }
@@ -1,10 +1,15 @@
+#include <float.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include <vulkan/vulkan.h>
 
 #define CGLTF_IMPLEMENTATION
 #include "../include/cgltf.h" //get ready for binary to explode in size
 #include "helpers.c"
+#include "mymappedfile.c"
+#include "mymeshfile.c"
+#include "mythreads.c"
 
 // borrows from myvulkan.c create index/vertex buffers cause thats where the api is called
 void gltfLoad()
@@ -23,95 +28,148 @@ void gltfLoad()
     cgltf_free(data);
 }
 
-void extractVertexDataFromPrimitive(const cgltf_primitive *primitive, Vertex **outVertices, size_t *outVertexCount)
+// the first attribute of a type (set 0 for texcoords), NULL when the primitive does not have one
+const cgltf_accessor *findAttributeAccessor(const cgltf_primitive *primitive, cgltf_attribute_type type)
 {
-    // Find and process each relevant attribute in the primitive
-    const cgltf_accessor *positionAccessor = NULL;
-    // Add other accessors as needed, e.g., for normals, texcoords, etc.
-
     for (size_t i = 0; i < primitive->attributes_count; i++)
     {
-        if (primitive->attributes[i].type == cgltf_attribute_type_position)
-        {
-            positionAccessor = primitive->attributes[i].data;
-        }
-        // Handle other attribute types similarly
+        if (primitive->attributes[i].type == type && primitive->attributes[i].index == 0)
+            return primitive->attributes[i].data;
     }
+    return NULL;
+}
 
-    if (positionAccessor == NULL)
-    {
-        // Position data not found
-        *outVertices = NULL;
-        *outVertexCount = 0;
-        return;
-    }
+const cgltf_accessor *findPositionAccessor(const cgltf_primitive *primitive)
+{
+    return findAttributeAccessor(primitive, cgltf_attribute_type_position);
+}
 
-    *outVertexCount = positionAccessor->count;
-    *outVertices = malloc(sizeof(Vertex) * (*outVertexCount));
-    if (*outVertices == NULL)
-    {
-        // Memory allocation failed
-        *outVertexCount = 0;
-        return;
-    }
+// first element of a non sparse accessor inside its buffer, NULL when the accessor has to be read through cgltf
+static const uint8_t *getAccessorData(const cgltf_accessor *accessor)
+{
+    if (!accessor->buffer_view || !accessor->buffer_view->buffer->data || accessor->is_sparse)
+        return NULL;
+    return (const uint8_t *)accessor->buffer_view->buffer->data + accessor->buffer_view->offset + accessor->offset;
+}
 
-    if (positionAccessor == NULL)
-    {
-        fprintf(stderr, "Position accessor not found\n");
-    }
+// what goes into a Vertex, positions drive the vertex count. attributes that are missing, or have a count or type
+// that does not fit the positions, are left NULL and packed as packVertexDefaults says
+typedef struct
+{
+    const cgltf_accessor *position;
+    const cgltf_accessor *normal;
+    const cgltf_accessor *tangent;
+    const cgltf_accessor *texcoord;
+} GltfVertexAccessors;
+
+static const cgltf_accessor *findMatchingAttribute(const cgltf_primitive *primitive, cgltf_attribute_type attributeType,
+                                                   cgltf_type type, size_t count)
+{
+    const cgltf_accessor *accessor = findAttributeAccessor(primitive, attributeType);
+    return accessor && accessor->type == type && accessor->count == count ? accessor : NULL;
+}
+
+static GltfVertexAccessors findVertexAccessors(const cgltf_primitive *primitive)
+{
+    GltfVertexAccessors accessors = {0};
+    accessors.position = findPositionAccessor(primitive);
+    if (accessors.position == NULL)
+        return accessors;
+
+    size_t count = accessors.position->count;
+    accessors.normal = findMatchingAttribute(primitive, cgltf_attribute_type_normal, cgltf_type_vec3, count);
+    accessors.tangent = findMatchingAttribute(primitive, cgltf_attribute_type_tangent, cgltf_type_vec4, count);
+    accessors.texcoord = findMatchingAttribute(primitive, cgltf_attribute_type_texcoord, cgltf_type_vec2, count);
+    return accessors;
+}
+
+// plain floats (what exporters write) are copied out of the (mapped) buffer, normalized integers, sparse accessors
+// and the rest go through cgltf
+static inline void readAccessorFloats(const cgltf_accessor *accessor, const uint8_t *source, size_t index, float *values, size_t count)
+{
+    if (source && accessor->component_type == cgltf_component_type_r_32f)
+        memcpy(values, source + index * accessor->stride, sizeof(float) * count);
     else
-    {
-        printf("Position accessor details: count = %zu, componentType = %d\n",
-               positionAccessor->count, positionAccessor->component_type);
-    }
-printf("positionAccessor->buffer_view->buffer->data: %s\n", (char *)positionAccessor->buffer_view->buffer->data);
-    // Extract position data
-    for (size_t i = 0; i < *outVertexCount; i++)
-    {
-        const float *position = (const float *)cgltf_accessor_read_index(positionAccessor, i);
-        
+        cgltf_accessor_read_float(accessor, index, values, count);
+}
+
+// vertices [first, first + count) of a primitive, packed into Vertex
+static void convertVertices(const GltfVertexAccessors *accessors, size_t first, size_t count, Vertex *vertices)
+{
+    const uint8_t *positions = getAccessorData(accessors->position);
+    const uint8_t *normals = accessors->normal ? getAccessorData(accessors->normal) : NULL;
+    const uint8_t *tangents = accessors->tangent ? getAccessorData(accessors->tangent) : NULL;
+    const uint8_t *texcoords = accessors->texcoord ? getAccessorData(accessors->texcoord) : NULL;
 
+    for (size_t i = 0; i < count; i++)
+    {
+        Vertex *vertex = &vertices[i];
+        size_t index = first + i;
+        packVertexDefaults(vertex);
+        readAccessorFloats(accessors->position, positions, index, vertex->inPosition, 3);
 
-        if (position != NULL)
+        if (accessors->normal)
         {
-            (*outVertices)[i].inPosition[0] = position[0];
-            (*outVertices)[i].inPosition[1] = position[1];
-            (*outVertices)[i].inPosition[2] = position[2];
-            printf("Vertex %zu: (%f, %f, %f)\n", i, position[0], position[1], position[2]);
+            float normal[3];
+            readAccessorFloats(accessors->normal, normals, index, normal, 3);
+            packNormal(normal, vertex->inNormal);
         }
-        else
+        if (accessors->tangent)
         {
-            printf("null vertices\n");
+            float tangent[4];
+            readAccessorFloats(accessors->tangent, tangents, index, tangent, 4);
+            packTangent(tangent, vertex->inTangent);
+        }
+        if (accessors->texcoord)
+        {
+            float uv[2];
+            readAccessorFloats(accessors->texcoord, texcoords, index, uv, 2);
+            vertex->inUv[0] = packHalf(uv[0]);
+            vertex->inUv[1] = packHalf(uv[1]);
         }
     }
-
-    // Extract other attribute data like normals, texcoords in a similar manner
 }
 
-void extractIndexDataFromPrimitive(const cgltf_primitive *primitive, uint16_t **outIndices, size_t *outIndexCount)
+// convertVertices, then the positions quantized into the mesh's box. goes through a small Vertex block on the stack
+static void convertQuantizedVertices(const GltfVertexAccessors *accessors, size_t first, size_t count,
+                                     const PositionQuantization *quantization, QuantizedVertex *vertices)
 {
-    if (primitive->indices == NULL)
+    Vertex block[256];
+    for (size_t blockFirst = 0; blockFirst < count; blockFirst += 256)
     {
-        // No indices
-        *outIndices = NULL;
-        *outIndexCount = 0;
-        fprintf(stderr, "no indices in gltf file\n");
-        exit(EXIT_FAILURE);
+        size_t blockCount = count - blockFirst < 256 ? count - blockFirst : 256;
+        convertVertices(accessors, first + blockFirst, blockCount, block);
+        for (size_t i = 0; i < blockCount; i++)
+        {
+            quantizeVertex(&block[i], quantization, &vertices[blockFirst + i]);
+        }
     }
+}
 
-    *outIndexCount = primitive->indices->count;
-    *outIndices = malloc(sizeof(uint16_t) * (*outIndexCount));
-    if (*outIndices == NULL)
+// grows the box by every position of an accessor. float accessors carry a min/max (required for positions by the
+// spec), the others (normalized integer positions) and accessors without one are scanned
+static void growPositionBounds(const cgltf_accessor *accessor, float boundsMin[3], float boundsMax[3])
+{
+    if (accessor->has_min && accessor->has_max && accessor->component_type == cgltf_component_type_r_32f)
     {
-        *outIndexCount = 0;
-        exit(EXIT_FAILURE);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            boundsMin[axis] = accessor->min[axis] < boundsMin[axis] ? accessor->min[axis] : boundsMin[axis];
+            boundsMax[axis] = accessor->max[axis] > boundsMax[axis] ? accessor->max[axis] : boundsMax[axis];
+        }
+        return;
     }
 
-    // Extract index data
-    for (size_t i = 0; i < *outIndexCount; i++)
+    const uint8_t *source = getAccessorData(accessor);
+    for (size_t i = 0; i < accessor->count; i++)
     {
-        uint16_t index = (uint16_t)cgltf_accessor_read_index(primitive->indices, i);
-        (*outIndices)[i] = index;
+        float position[3];
+        readAccessorFloats(accessor, source, i, position, 3);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            boundsMin[axis] = position[axis] < boundsMin[axis] ? position[axis] : boundsMin[axis];
+            boundsMax[axis] = position[axis] > boundsMax[axis] ? position[axis] : boundsMax[axis];
+        }
     }
 }
 
@@ -145,9 +203,291 @@ void debugResultHandler(cgltf_result result)
     }
 }
 
-uint32_t loadGltfMeshes(const char *filename, VkDevice device, VkPhysicalDevice physicalDevice, VkBuffer *vertexBuffer, VkDeviceMemory *vertexBufferMemory, VkBuffer *indexBuffer, VkDeviceMemory *indexBufferMemory)
+// cgltf file callbacks that map files instead of reading them into the heap. the json, a .glb and its binary chunk,
+// and external .bin buffers all stay in the mappings, accessors are read in place and cgltf_free unmaps them
+#define GLTF_MAX_MAPPED_FILES 64
+
+typedef struct
+{
+    MappedFile files[GLTF_MAX_MAPPED_FILES];
+    uint32_t fileCount;
+    size_t mappedBytes; // everything mapped during the load, for stats
+} GltfFileMappings;
+
+static cgltf_result mapGltfFile(const cgltf_memory_options *memoryOptions, const cgltf_file_options *fileOptions, const char *path, cgltf_size *size, void **data)
+{
+    (void)memoryOptions;
+    GltfFileMappings *mappings = fileOptions->user_data;
+    if (mappings->fileCount == GLTF_MAX_MAPPED_FILES)
+        return cgltf_result_out_of_memory;
+
+    MappedFile file;
+    if (!mapFile(path, &file))
+        return cgltf_result_file_not_found;
+
+    // buffers ask for their byteLength, the file may be longer but never shorter
+    if (size && *size > file.size)
+    {
+        unmapFile(&file);
+        return cgltf_result_data_too_short;
+    }
+
+    mappings->files[mappings->fileCount++] = file;
+    mappings->mappedBytes += file.size;
+    if (size && *size == 0)
+        *size = file.size;
+    *data = (void *)file.data; // cgltf never writes into file data, the mapping is read only
+    return cgltf_result_success;
+}
+
+static void unmapGltfFile(const cgltf_memory_options *memoryOptions, const cgltf_file_options *fileOptions, void *data)
+{
+    (void)memoryOptions;
+    GltfFileMappings *mappings = fileOptions->user_data;
+    for (uint32_t i = 0; i < mappings->fileCount; i++)
+    {
+        if (mappings->files[i].data == data)
+        {
+            unmapFile(&mappings->files[i]);
+            mappings->files[i] = mappings->files[--mappings->fileCount];
+            return;
+        }
+    }
+}
+
+static inline uint32_t readPackedIndex(const uint8_t *source, cgltf_component_type componentType)
+{
+    switch (componentType)
+    {
+    case cgltf_component_type_r_8u:
+        return *source;
+    case cgltf_component_type_r_16u:
+    {
+        uint16_t index;
+        memcpy(&index, source, sizeof(index));
+        return index;
+    }
+    default:
+    {
+        uint32_t index;
+        memcpy(&index, source, sizeof(index));
+        return index;
+    }
+    }
+}
+
+// indices [first, first + count) of an accessor as uint16 (narrow) or uint32, one memcpy when the buffer already
+// stores them that way, otherwise widened or narrowed element by element. false when an index is not below
+// vertexCount, it would draw from the next primitive or past the vertex buffer
+static bool convertIndices(const cgltf_accessor *accessor, size_t first, size_t count, size_t vertexCount, bool narrow, void *indices)
+{
+    const uint8_t *source = getAccessorData(accessor);
+    size_t indexSize = narrow ? sizeof(uint16_t) : sizeof(uint32_t);
+    cgltf_component_type componentType = narrow ? cgltf_component_type_r_16u : cgltf_component_type_r_32u;
+    uint32_t maxIndex = 0;
+
+    if (source && accessor->component_type == componentType && accessor->stride == indexSize)
+    {
+        memcpy(indices, source + first * indexSize, indexSize * count);
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t index = narrow ? ((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i];
+            maxIndex = index > maxIndex ? index : maxIndex;
+        }
+        return count == 0 || maxIndex < vertexCount;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t index = source ? readPackedIndex(source + (first + i) * accessor->stride, accessor->component_type)
+                                : (uint32_t)cgltf_accessor_read_index(accessor, first + i);
+        maxIndex = index > maxIndex ? index : maxIndex;
+        if (narrow)
+            ((uint16_t *)indices)[i] = (uint16_t)index;
+        else
+            ((uint32_t *)indices)[i] = index;
+    }
+    return count == 0 || maxIndex < vertexCount;
+}
+
+#define GLTF_EXTRACT_TASK_ELEMENTS 16384 // per thread pool task, one big primitive still spreads over every thread
+
+// the geometry of a gltf is three streams: vertices, 16-bit indices, 32-bit indices. each is the concatenation of
+// the primitives' accessors in draw range order, so a stream position is a vertexOffset or a firstIndex
+typedef enum
+{
+    GLTF_STREAM_VERTICES,
+    GLTF_STREAM_INDICES16,
+    GLTF_STREAM_INDICES32,
+} GltfStream;
+
+typedef struct
+{
+    const cgltf_accessor *accessor;
+    const GltfVertexAccessors *vertexAccessors; // the vertex stream's attributes, accessor is their position
+    size_t first; // element of the accessor
+    size_t count;
+    size_t windowOffset; // bytes into the staging window
+    bool outOfRange;     // index streams: an index was not below the primitive's vertex count
+} GltfExtractTask;
+
+typedef struct
+{
+    GltfExtractTask *tasks;
+    GltfStream stream;
+    const PositionQuantization *quantization; // QuantizedVertex instead of Vertex in the vertex stream
+    char *window;
+} GltfExtractBatch;
+
+static void runGltfExtractTask(void *userData, uint32_t taskIndex)
 {
+    const GltfExtractBatch *batch = userData;
+    GltfExtractTask *task = &batch->tasks[taskIndex];
+    char *destination = batch->window + task->windowOffset;
+
+    if (batch->stream == GLTF_STREAM_VERTICES && batch->quantization)
+        convertQuantizedVertices(task->vertexAccessors, task->first, task->count, batch->quantization, (QuantizedVertex *)destination);
+    else if (batch->stream == GLTF_STREAM_VERTICES)
+        convertVertices(task->vertexAccessors, task->first, task->count, (Vertex *)destination);
+    else
+        task->outOfRange = !convertIndices(task->accessor, task->first, task->count, task->vertexAccessors->position->count,
+                                           batch->stream == GLTF_STREAM_INDICES16, destination);
+}
+
+// extracts one stream into dstBuffer at dstOffset, straight into staging ring space: the stream is walked in windows of
+// up to half the ring, the thread pool fills each window's reservation in GLTF_EXTRACT_TASK_ELEMENTS pieces and the
+// window goes to the mesh buffer as one copy. vertexAccessors has an entry per accessor: the attributes to convert for
+// the vertex stream, for the index streams those of the primitive the indices draw from. a quantization makes the vertex
+// stream QuantizedVertex. returns the first index accessor with an index past its primitive's vertices, NULL when all fit
+static const cgltf_accessor *extractGltfStream(ThreadPool *threadPool, StagingRing *stagingRing, GltfStream stream, const cgltf_accessor **accessors,
+                              const GltfVertexAccessors *vertexAccessors, const PositionQuantization *quantization, uint32_t accessorCount,
+                              VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+    size_t vertexSize = quantization ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    size_t elementSize = stream == GLTF_STREAM_VERTICES ? vertexSize : stream == GLTF_STREAM_INDICES16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    size_t windowCapacity = (stagingRing->size / 2) / elementSize;
+
+    // a task is either GLTF_EXTRACT_TASK_ELEMENTS long or ends an accessor or the window
+    size_t taskCapacity = windowCapacity / GLTF_EXTRACT_TASK_ELEMENTS + accessorCount + 1;
+    GltfExtractBatch batch = {0};
+    batch.tasks = malloc(sizeof(GltfExtractTask) * taskCapacity);
+    batch.stream = stream;
+    batch.quantization = quantization;
+    if (!batch.tasks)
+    {
+        fprintf(stderr, "Failed to allocate gltf extraction tasks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const cgltf_accessor *outOfRange = NULL;
+    uint32_t accessorIndex = 0;
+    size_t accessorFirst = 0;
+    size_t streamPosition = 0;
+    while (accessorIndex < accessorCount)
+    {
+        size_t windowCount = 0;
+        uint32_t taskCount = 0;
+        while (accessorIndex < accessorCount && windowCount < windowCapacity)
+        {
+            const cgltf_accessor *accessor = accessors[accessorIndex];
+            size_t count = accessor->count - accessorFirst;
+            count = count < GLTF_EXTRACT_TASK_ELEMENTS ? count : GLTF_EXTRACT_TASK_ELEMENTS;
+            count = count < windowCapacity - windowCount ? count : windowCapacity - windowCount;
+
+            if (count > 0)
+                batch.tasks[taskCount++] = (GltfExtractTask){accessor, &vertexAccessors[accessorIndex], accessorFirst, count,
+                                                             windowCount * elementSize, false};
+            windowCount += count;
+            accessorFirst += count;
+            if (accessorFirst == accessor->count)
+            {
+                accessorIndex++;
+                accessorFirst = 0;
+            }
+        }
+        if (windowCount == 0)
+            break;
+
+        VkDeviceSize srcOffset;
+        batch.window = stagingRingReserve(stagingRing, windowCount * elementSize, 16, &srcOffset);
+        threadPoolRun(threadPool, taskCount, runGltfExtractTask, &batch);
+        for (uint32_t i = 0; i < taskCount && outOfRange == NULL; i++)
+        {
+            if (batch.tasks[i].outOfRange)
+                outOfRange = batch.tasks[i].accessor;
+        }
+        stagingRingCopyToBuffer(stagingRing, srcOffset, dstBuffer, dstOffset + streamPosition * elementSize, windowCount * elementSize);
+        streamPosition += windowCount;
+    }
+
+    free(batch.tasks);
+    return outOfRange;
+}
+
+static void printPrimitive(const cgltf_accessor *positionAccessor, const cgltf_accessor *indexAccessor)
+{
+    printf("Position accessor details: count = %zu, componentType = %d, stride = %zu\n",
+           positionAccessor->count, positionAccessor->component_type, positionAccessor->stride);
+    for (size_t i = 0; i < positionAccessor->count; i++)
+    {
+        float position[3];
+        cgltf_accessor_read_float(positionAccessor, i, position, 3);
+        printf("Vertex %zu: (%f, %f, %f)\n", i, position[0], position[1], position[2]);
+    }
+    for (size_t i = 0; i < indexAccessor->count; i++)
+    {
+        printf("Index %zu: %u\n", i, (uint32_t)cgltf_accessor_read_index(indexAccessor, i));
+    }
+}
+
+// wall clock per load stage, printed after every load
+typedef struct
+{
+    double parseSeconds;
+    double bufferSeconds; // mapping .bin files / decoding data uris
+    double uploadSeconds; // accessors straight into the staging ring
+    uint32_t threadCount; // extracting the accessors
+    size_t mappedBytes;
+    uint64_t peakRssBytes; // of the whole process, right after the load
+    size_t vertexCount;
+    size_t indexCount;
+    size_t indexCount16; // indices narrowed to 16 bits
+    size_t primitiveCount;
+    size_t normalPrimitiveCount; // primitives with that attribute, the others get packVertexDefaults
+    size_t tangentPrimitiveCount;
+    size_t texcoordPrimitiveCount;
+} GltfLoadStats;
+
+void printGltfLoadStats(const char *filename, const GltfLoadStats *stats)
+{
+    printf("gltf %s: %zu primitives, %zu vertices, %zu indices (%zu 16-bit), normals/tangents/uvs on %zu/%zu/%zu primitives"
+           " | parse %.2f ms, buffers %.2f ms, upload %.2f ms on %u threads | %.1f MB mapped, peak rss %.1f MB\n",
+           filename, stats->primitiveCount, stats->vertexCount, stats->indexCount, stats->indexCount16,
+           stats->normalPrimitiveCount, stats->tangentPrimitiveCount, stats->texcoordPrimitiveCount,
+           stats->parseSeconds * 1000.0, stats->bufferSeconds * 1000.0, stats->uploadSeconds * 1000.0, stats->threadCount,
+           stats->mappedBytes / (1024.0 * 1024.0), stats->peakRssBytes / (1024.0 * 1024.0));
+}
+
+// files are mapped, not read, and geometry goes from the mapping into the staging ring without a heap copy.
+// two passes: the first sizes every primitive from its accessor counts and lays them out with prefix offsets, the
+// second extracts the accessors on threadPool straight into staging space at those offsets.
+// every primitive keeps its indices local and gets a draw range with its vertexOffset into the shared vertex buffer,
+// primitives with at most 65536 vertices get 16-bit indices. quantizePositions stores positions as unorm16 inside the
+// union of the position accessors' min/max. verbose prints every vertex and index, which makes loading as slow as the terminal
+void loadGltfMeshes(const char *filename, bool verbose, bool quantizePositions, ThreadPool *threadPool, GpuAllocator *allocator,
+                    StagingRing *stagingRing, Mesh *mesh)
+{
+    GltfLoadStats stats = {0};
+    double stageStart = getTimeSeconds();
+
+    // has to outlive data, cgltf_free hands the mapped files back through it
+    GltfFileMappings mappings = {0};
+
     cgltf_options options = {0};
+    options.file.read = mapGltfFile;
+    options.file.release = unmapGltfFile;
+    options.file.user_data = &mappings;
+
     cgltf_data *data = NULL;
     cgltf_result result = cgltf_parse_file(&options, filename, &data);
 
@@ -159,58 +499,237 @@ uint32_t loadGltfMeshes(const char *filename, VkDevice device, VkPhysicalDevice
         exit(EXIT_FAILURE);
     }
 
-    Vertex *allVertices = NULL;
-    uint16_t *allIndices = NULL;
-    size_t totalVertexCount = 0;
-    size_t totalIndexCount = 0;
+    double now = getTimeSeconds();
+    stats.parseSeconds = now - stageStart;
+    stageStart = now;
 
+    // without this the buffers of a .gltf with external .bin files have no data
+    result = cgltf_load_buffers(&options, data, filename);
+    if (result != cgltf_result_success)
+    {
+        fprintf(stderr, "Error loading the buffers of %s\n", filename);
+        debugResultHandler(result);
+        exit(EXIT_FAILURE);
+    }
+
+    now = getTimeSeconds();
+    stats.bufferSeconds = now - stageStart;
+    stats.mappedBytes = mappings.mappedBytes;
+    stageStart = now;
+
+    // lay out every primitive first, the device buffers are created once at their final size
+    size_t totalPrimitiveCount = 0;
     for (size_t i = 0; i < data->meshes_count; i++)
     {
-        cgltf_mesh *mesh = &data->meshes[i];
-        for (size_t j = 0; j < mesh->primitives_count; j++)
-        {
-            cgltf_primitive *primitive = &mesh->primitives[j];
+        totalPrimitiveCount += data->meshes[i].primitives_count;
+    }
 
-            Vertex *vertices;
-            size_t vertexCount;
-            extractVertexDataFromPrimitive(primitive, &vertices, &vertexCount);
+    // per draw range, and each range's accessors in the stream it goes to
+    size_t arrayCount = totalPrimitiveCount > 0 ? totalPrimitiveCount : 1;
+    DrawRange *ranges = malloc(sizeof(DrawRange) * arrayCount);
+    const cgltf_accessor **positionAccessors = malloc(sizeof(cgltf_accessor *) * arrayCount);
+    GltfVertexAccessors *vertexAccessors = malloc(sizeof(GltfVertexAccessors) * arrayCount);
+    const cgltf_accessor **indexAccessors = malloc(sizeof(cgltf_accessor *) * arrayCount);
+    const cgltf_accessor **indexAccessors16 = malloc(sizeof(cgltf_accessor *) * arrayCount);
+    const cgltf_accessor **indexAccessors32 = malloc(sizeof(cgltf_accessor *) * arrayCount);
+    GltfVertexAccessors *vertexAccessors16 = malloc(sizeof(GltfVertexAccessors) * arrayCount); // bound the indices
+    GltfVertexAccessors *vertexAccessors32 = malloc(sizeof(GltfVertexAccessors) * arrayCount);
+    if (!ranges || !positionAccessors || !vertexAccessors || !indexAccessors || !indexAccessors16 || !indexAccessors32 ||
+        !vertexAccessors16 || !vertexAccessors32)
+    {
+        fprintf(stderr, "Failed to allocate draw ranges of %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
 
-            uint16_t *indices;
-            size_t indexCount;
-            extractIndexDataFromPrimitive(primitive, &indices, &indexCount);
+    size_t vertexCount = 0;
+    size_t indexCount16 = 0;
+    size_t indexCount32 = 0;
+    uint32_t rangeCount = 0;
+    uint32_t rangeCount16 = 0;
+    uint32_t rangeCount32 = 0;
+    float boundsMin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float boundsMax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (size_t i = 0; i < data->meshes_count; i++)
+    {
+        for (size_t j = 0; j < data->meshes[i].primitives_count; j++)
+        {
+            const cgltf_primitive *primitive = &data->meshes[i].primitives[j];
+            const cgltf_accessor *positionAccessor = findPositionAccessor(primitive);
+            if (positionAccessor == NULL || positionAccessor->type != cgltf_type_vec3)
+            {
+                fprintf(stderr, "Primitive has no vec3 position accessor, skipping it\n");
+                continue;
+            }
+            if (primitive->indices == NULL)
+            {
+                fprintf(stderr, "no indices in gltf file\n");
+                exit(EXIT_FAILURE);
+            }
 
-            for (size_t k = 0; k < vertexCount; k++)
+            vertexAccessors[rangeCount] = findVertexAccessors(primitive);
+            stats.normalPrimitiveCount += vertexAccessors[rangeCount].normal != NULL;
+            stats.tangentPrimitiveCount += vertexAccessors[rangeCount].tangent != NULL;
+            stats.texcoordPrimitiveCount += vertexAccessors[rangeCount].texcoord != NULL;
+            positionAccessors[rangeCount] = positionAccessor;
+            indexAccessors[rangeCount] = primitive->indices;
+            DrawRange *range = &ranges[rangeCount++];
+            range->indexCount = (uint32_t)primitive->indices->count;
+            range->vertexOffset = (int32_t)vertexCount;
+            if (positionAccessor->count <= (size_t)UINT16_MAX + 1)
+            {
+                range->indexType = VK_INDEX_TYPE_UINT16;
+                range->firstIndex = (uint32_t)indexCount16;
+                indexCount16 += primitive->indices->count;
+                vertexAccessors16[rangeCount16] = vertexAccessors[rangeCount - 1];
+                indexAccessors16[rangeCount16++] = primitive->indices;
+            }
+            else
             {
-                // printf("Vertex %zu: (%f, %f, %f)\n", k, vertices[k].inPosition[0], vertices[k].inPosition[1], vertices[k].inPosition[2]);
+                range->indexType = VK_INDEX_TYPE_UINT32;
+                range->firstIndex = (uint32_t)indexCount32;
+                indexCount32 += primitive->indices->count;
+                vertexAccessors32[rangeCount32] = vertexAccessors[rangeCount - 1];
+                indexAccessors32[rangeCount32++] = primitive->indices;
             }
+            vertexCount += positionAccessor->count;
+            if (quantizePositions)
+                growPositionBounds(positionAccessor, boundsMin, boundsMax);
+        }
+    }
 
-            for (size_t k = 0; k < indexCount; k++)
+    createMeshBuffers(allocator, quantizePositions, (uint32_t)vertexCount, (uint32_t)indexCount16, (uint32_t)indexCount32, mesh);
+    if (quantizePositions)
+        mesh->positionQuantization = makePositionQuantization(boundsMin, boundsMax);
+
+    extractGltfStream(threadPool, stagingRing, GLTF_STREAM_VERTICES, positionAccessors, vertexAccessors,
+                      quantizePositions ? &mesh->positionQuantization : NULL, rangeCount, mesh->vertexBuffer, 0);
+    const cgltf_accessor *outOfRange16 = extractGltfStream(threadPool, stagingRing, GLTF_STREAM_INDICES16, indexAccessors16, vertexAccessors16, NULL,
+                                                           rangeCount16, mesh->indexBuffer, mesh->indexOffsets[0]);
+    const cgltf_accessor *outOfRange32 = extractGltfStream(threadPool, stagingRing, GLTF_STREAM_INDICES32, indexAccessors32, vertexAccessors32, NULL,
+                                                           rangeCount32, mesh->indexBuffer, mesh->indexOffsets[1]);
+    if (outOfRange16 || outOfRange32)
+    {
+        const cgltf_accessor *accessor = outOfRange16 ? outOfRange16 : outOfRange32;
+        for (size_t i = 0; i < data->meshes_count; i++)
+        {
+            for (size_t j = 0; j < data->meshes[i].primitives_count; j++)
             {
-                printf("Index %zu: %u\n", k, indices[k]);
+                if (data->meshes[i].primitives[j].indices == accessor)
+                    fprintf(stderr, "%s: primitive %zu of mesh %zu has indices past its %zu vertices\n", filename, j, i,
+                            findPositionAccessor(&data->meshes[i].primitives[j])->count);
             }
+        }
+        exit(EXIT_FAILURE);
+    }
 
-            // Reallocate and append new vertices and indices
-            allVertices = realloc(allVertices, sizeof(Vertex) * (totalVertexCount + vertexCount));
-            memcpy(allVertices + totalVertexCount, vertices, sizeof(Vertex) * vertexCount);
-            free(vertices);
+    for (uint32_t i = 0; i < rangeCount && verbose; i++)
+    {
+        printPrimitive(positionAccessors[i], indexAccessors[i]);
+    }
+    free(positionAccessors);
+    free(vertexAccessors);
+    free(indexAccessors);
+    free(indexAccessors16);
+    free(indexAccessors32);
+    free(vertexAccessors16);
+    free(vertexAccessors32);
+
+    // the mesh owns the ranges from here on, destroyMesh frees them
+    mesh->ranges = ranges;
+    mesh->rangeCount = rangeCount;
+
+    // the mappings were only read while filling staging space, they can go before the copies run
+    cgltf_free(data);
 
-            allIndices = realloc(allIndices, sizeof(uint16_t) * (totalIndexCount + indexCount));
-            memcpy(allIndices + totalIndexCount, indices, sizeof(uint16_t) * indexCount);
-            free(indices);
+    stats.uploadSeconds = getTimeSeconds() - stageStart;
+    stats.threadCount = threadPool->workerCount + 1;
+    stats.peakRssBytes = getPeakRssBytes();
+    stats.vertexCount = vertexCount;
+    stats.indexCount = indexCount16 + indexCount32;
+    stats.indexCount16 = indexCount16;
+    stats.primitiveCount = rangeCount;
+    printGltfLoadStats(filename, &stats);
+}
 
-            totalVertexCount += vertexCount;
-            totalIndexCount += indexCount;
-        }
+// a cooked mesh (tests/cooker.c) is mapped and its sections go to the staging ring as they are, three uploads in
+// total. quantizePositions quantizes the vertices into the file's bounds on the way into the ring. false when there
+// is no valid cooked file at path
+bool loadCookedMesh(const char *path, bool quantizePositions, GpuAllocator *allocator, StagingRing *stagingRing, Mesh *mesh)
+{
+    double start = getTimeSeconds();
+
+    MeshFile meshFile;
+    if (!openMeshFile(path, &meshFile))
+        return false;
+
+    const MeshFileHeader *header = meshFile.header;
+    createMeshBuffers(allocator, quantizePositions, (uint32_t)header->vertexCount, (uint32_t)header->indexCount16, (uint32_t)header->indexCount32, mesh);
+
+    if (quantizePositions)
+    {
+        mesh->positionQuantization = makePositionQuantization(header->boundsMin, header->boundsMax);
+        uploadQuantizedVertices(stagingRing, mesh->vertexBuffer, meshFile.vertices, header->vertexCount, &mesh->positionQuantization);
+    }
+    else
+        stagingRingUploadBuffer(stagingRing, mesh->vertexBuffer, 0, meshFile.vertices, sizeof(Vertex) * header->vertexCount);
+    if (header->indexCount16 > 0)
+        stagingRingUploadBuffer(stagingRing, mesh->indexBuffer, mesh->indexOffsets[0], meshFile.indices16, sizeof(uint16_t) * header->indexCount16);
+    if (header->indexCount32 > 0)
+        stagingRingUploadBuffer(stagingRing, mesh->indexBuffer, mesh->indexOffsets[1], meshFile.indices32, sizeof(uint32_t) * header->indexCount32);
+
+    mesh->ranges = malloc(sizeof(DrawRange) * (header->rangeCount > 0 ? header->rangeCount : 1));
+    mesh->rangeCount = header->rangeCount;
+    for (uint32_t i = 0; i < header->rangeCount; i++)
+    {
+        const MeshFileRange *range = &meshFile.ranges[i];
+        mesh->ranges[i].firstIndex = range->firstIndex;
+        mesh->ranges[i].indexCount = range->indexCount;
+        mesh->ranges[i].vertexOffset = range->vertexOffset;
+        mesh->ranges[i].indexType = range->indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
     }
 
-    // Create Vulkan buffers using the combined vertices and indices
-    createVertexBuffer(device, physicalDevice, allVertices, totalVertexCount, vertexBuffer, vertexBufferMemory);
-    createIndexBuffer(device, physicalDevice, allIndices, totalIndexCount, indexBuffer, indexBufferMemory);
+    printf("cooked mesh %s: %u ranges, %llu vertices, %llu indices (%llu 16-bit) | load %.2f ms | %.1f MB mapped, peak rss %.1f MB\n",
+           path, header->rangeCount, (unsigned long long)header->vertexCount,
+           (unsigned long long)(header->indexCount16 + header->indexCount32), (unsigned long long)header->indexCount16,
+           (getTimeSeconds() - start) * 1000.0, meshFile.file.size / (1024.0 * 1024.0), getPeakRssBytes() / (1024.0 * 1024.0));
 
-    // Free the combined buffers
-    free(allVertices);
-    free(allIndices);
+    // the uploads copied out of the mapping while they were recorded
+    closeMeshFile(&meshFile);
+    return true;
+}
 
-    cgltf_free(data);
-    return totalIndexCount;
+static bool isFileNewer(const char *path, const char *otherPath)
+{
+    struct stat status, otherStatus;
+    return stat(path, &status) == 0 && stat(otherPath, &otherStatus) == 0 && status.st_mtime > otherStatus.st_mtime;
+}
+
+// a .mesh path is loaded as a cooked mesh. for a gltf the cooked file next to it (path + MESH_FILE_EXTENSION) is
+// used when there is one that is not older than the gltf, otherwise the gltf itself. verbose always reads the gltf
+void loadModel(const char *path, bool verbose, bool quantizePositions, ThreadPool *threadPool, GpuAllocator *allocator,
+               StagingRing *stagingRing, Mesh *mesh)
+{
+    size_t length = strlen(path);
+    size_t extensionLength = strlen(MESH_FILE_EXTENSION);
+    if (length >= extensionLength && strcmp(path + length - extensionLength, MESH_FILE_EXTENSION) == 0)
+    {
+        if (!loadCookedMesh(path, quantizePositions, allocator, stagingRing, mesh))
+        {
+            fprintf(stderr, "Failed to load cooked mesh %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    char cookedPath[1024];
+    snprintf(cookedPath, sizeof(cookedPath), "%s%s", path, MESH_FILE_EXTENSION);
+    if (!verbose)
+    {
+        if (isFileNewer(path, cookedPath))
+            printf("%s is older than %s, loading the gltf (cook it again)\n", cookedPath, path);
+        else if (loadCookedMesh(cookedPath, quantizePositions, allocator, stagingRing, mesh))
+            return;
+    }
+
+    loadGltfMeshes(path, verbose, quantizePositions, threadPool, allocator, stagingRing, mesh);
 }
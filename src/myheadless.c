@@ -0,0 +1,163 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mymemory.c"
+
+// headless mode: no glfw window, no surface, no swap chain. frames render into offscreen images instead,
+// which is what the linux ci/perf boxes (lavapipe, no display) can run unattended.
+
+#define HEADLESS_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+#define HEADLESS_DEFAULT_FRAME_COUNT 1000
+
+// stands in for the swap chain: one color image per frame in flight so frames never write the same image
+typedef struct
+{
+    VkExtent2D extent;
+    uint32_t imageCount;
+    VkImage *images;
+    GpuAllocation *allocations;
+    VkImageView *imageViews;
+    VkFramebuffer *framebuffers;
+} OffscreenTarget;
+
+static bool hasInstanceExtension(const VkExtensionProperties *extensions, uint32_t extensionCount, const char *name)
+{
+    for (uint32_t i = 0; i < extensionCount; i++)
+    {
+        if (strcmp(extensions[i].extensionName, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// instance without glfw or surface extensions and without validation layers (they would skew timings)
+VkInstance createHeadlessVulkanInstance()
+{
+    uint32_t availableCount = 0;
+    vkEnumerateInstanceExtensionProperties(NULL, &availableCount, NULL);
+    VkExtensionProperties *available = malloc(availableCount * sizeof(VkExtensionProperties));
+    vkEnumerateInstanceExtensionProperties(NULL, &availableCount, available);
+
+    // portability enumeration is only needed (and only present) on MoltenVK style loaders
+    const char *extensions[1];
+    uint32_t extensionCount = 0;
+    bool portability = hasInstanceExtension(available, availableCount, "VK_KHR_portability_enumeration");
+    if (portability)
+        extensions[extensionCount++] = "VK_KHR_portability_enumeration";
+    free(available);
+
+    VkApplicationInfo appInfo = {0};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Hello Vulkan (headless)";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_2;
+
+    VkInstanceCreateInfo createInfo = {0};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+    createInfo.enabledExtensionCount = extensionCount;
+    createInfo.ppEnabledExtensionNames = extensionCount > 0 ? extensions : NULL;
+    createInfo.flags = portability ? VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR : 0;
+
+    VkInstance instance;
+    if (vkCreateInstance(&createInfo, NULL, &instance) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create headless Vulkan instance\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return instance;
+}
+
+OffscreenTarget createOffscreenTarget(GpuAllocator *allocator, VkRenderPass renderPass, VkExtent2D extent, uint32_t imageCount)
+{
+    VkDevice device = allocator->device;
+
+    OffscreenTarget target = {0};
+    target.extent = extent;
+    target.imageCount = imageCount;
+    target.images = malloc(sizeof(VkImage) * imageCount);
+    target.allocations = malloc(sizeof(GpuAllocation) * imageCount);
+    target.imageViews = malloc(sizeof(VkImageView) * imageCount);
+    target.framebuffers = malloc(sizeof(VkFramebuffer) * imageCount);
+
+    for (uint32_t i = 0; i < imageCount; i++)
+    {
+        VkImageCreateInfo imageInfo = {0};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = HEADLESS_FORMAT;
+        imageInfo.extent = (VkExtent3D){extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkCreateImage(device, &imageInfo, NULL, &target.images[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create offscreen image\n");
+            exit(EXIT_FAILURE);
+        }
+
+        gpuAllocateImage(allocator, target.images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target.allocations[i]);
+
+        VkImageViewCreateInfo viewInfo = {0};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = target.images[i];
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = HEADLESS_FORMAT;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        if (vkCreateImageView(device, &viewInfo, NULL, &target.imageViews[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create offscreen image view\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkFramebufferCreateInfo framebufferInfo = {0};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &target.imageViews[i];
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &target.framebuffers[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create offscreen framebuffer\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return target;
+}
+
+void destroyOffscreenTarget(GpuAllocator *allocator, OffscreenTarget *target)
+{
+    for (uint32_t i = 0; i < target->imageCount; i++)
+    {
+        vkDestroyFramebuffer(allocator->device, target->framebuffers[i], NULL);
+        vkDestroyImageView(allocator->device, target->imageViews[i], NULL);
+        vkDestroyImage(allocator->device, target->images[i], NULL);
+        gpuFree(allocator, &target->allocations[i]);
+    }
+
+    free(target->framebuffers);
+    free(target->imageViews);
+    free(target->allocations);
+    free(target->images);
+    *target = (OffscreenTarget){0};
+}
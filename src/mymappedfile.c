@@ -0,0 +1,113 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read only file mappings. the pages come straight out of the page cache when they are first touched, nothing is
+// read up front or copied into the heap, and clean pages can be dropped by the os instead of being swapped out.
+
+typedef struct
+{
+    const void *data;
+    size_t size;
+} MappedFile;
+
+// false when the file is missing, empty or cannot be mapped
+bool mapFile(const char *path, MappedFile *file)
+{
+    *file = (MappedFile){0};
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+
+    // the view keeps the mapping and the file open, both handles can go right away
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (mapping == NULL)
+        return false;
+
+    const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL)
+        return false;
+
+    file->data = data;
+    file->size = (size_t)size.QuadPart;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        return false;
+    }
+
+    void *data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor); // the mapping holds its own reference to the file
+    if (data == MAP_FAILED)
+        return false;
+
+    file->data = data;
+    file->size = (size_t)status.st_size;
+#endif
+    return true;
+}
+
+void unmapFile(MappedFile *file)
+{
+    if (file->data == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+#else
+    munmap((void *)file->data, file->size);
+#endif
+    *file = (MappedFile){0};
+}
+
+// high water mark of the resident set of this process, 0 where the platform does not say
+uint64_t getPeakRssBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss; // bytes on macos
+#else
+    return (uint64_t)usage.ru_maxrss * 1024; // kilobytes on linux
+#endif
+#endif
+}
@@ -0,0 +1,665 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "helpers.c"
+
+// block based sub-allocator: one pool per memory type, each pool owns a list of big VkDeviceMemory blocks
+// and every buffer gets an aligned range out of one of them (keeps us far away from maxMemoryAllocationCount)
+// host visible blocks are mapped once when they are created and stay mapped until they are released,
+// so nothing outside this file should ever call vkMapMemory/vkUnmapMemory on allocator memory.
+// allocating, freeing, flushing and stats take the allocator mutex, the asset loader thread allocates too
+
+#define GPU_MEMORY_PREFERRED_BLOCK_SIZE (64ull * 1024 * 1024) // 64 MiB blocks unless the heap is small
+
+typedef struct
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} GpuMemoryRange;
+
+typedef struct
+{
+    VkDeviceMemory memory; // VK_NULL_HANDLE means the slot is unused and can be recycled
+    VkDeviceSize size;
+    VkDeviceSize usedBytes;    // bytes handed out (including alignment padding)
+    VkDeviceSize paddingBytes; // bytes lost to alignment inside live allocations
+    uint32_t allocationCount;
+    bool dedicated; // holds exactly one allocation that was too big for a shared block
+    char *mapped;   // persistent mapping of the whole block, NULL for device local only memory
+
+    GpuMemoryRange *freeRanges; // sorted by offset, neighbours are merged on free
+    uint32_t freeRangeCount;
+    uint32_t freeRangeCapacity;
+} GpuMemoryBlock;
+
+typedef struct
+{
+    GpuMemoryBlock *blocks;
+    uint32_t blockCount;
+    VkDeviceSize blockSize;
+} GpuMemoryPool;
+
+typedef struct
+{
+    VkDevice device;
+    VkPhysicalDevice physicalDevice;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    uint32_t maxAllocationCount;
+    VkDeviceSize nonCoherentAtomSize;
+    VkDeviceSize bufferImageGranularity; // optimal images and buffers never share a page of this size
+    uint32_t deviceAllocationCount; // live vkAllocateMemory calls
+    GpuMemoryPool pools[VK_MAX_MEMORY_TYPES];
+    pthread_mutex_t mutex; // pools and blocks, a new block can move the blocks array
+} GpuAllocator;
+
+typedef struct
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset; // aligned offset to bind at
+    VkDeviceSize size;   // size that was asked for
+
+    // the range actually taken from the block (offset - rangeOffset is alignment padding)
+    VkDeviceSize rangeOffset;
+    VkDeviceSize rangeSize;
+
+    uint32_t memoryTypeIndex;
+    uint32_t blockIndex;
+
+    void *mapped;  // points at offset inside the persistent block mapping, NULL if not host visible
+    bool coherent; // writes through mapped need a gpuFlushAllocation when false
+} GpuAllocation;
+
+// one buffer holding a slice per frame in flight (uniforms, instance data)
+typedef struct
+{
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    VkDeviceSize sliceSize; // stride between slices, already aligned
+    uint32_t sliceCount;
+} FrameSlicedBuffer;
+
+typedef enum
+{
+    RETIRED_BUFFER,
+    RETIRED_IMAGE_VIEW,
+    RETIRED_FRAMEBUFFER,
+    RETIRED_SEMAPHORE,
+    RETIRED_SWAPCHAIN,
+} RetiredResourceType;
+
+// objects that may still be used by frames in flight, destroyed once the frame that retired them has finished
+typedef struct
+{
+    RetiredResourceType type;
+    uint64_t frameNumber; // frame that was being built when the object was retired
+    union
+    {
+        struct
+        {
+            VkBuffer buffer;
+            GpuAllocation allocation;
+        };
+        VkImageView imageView;
+        VkFramebuffer framebuffer;
+        VkSemaphore semaphore;
+        VkSwapchainKHR swapchain;
+    };
+} RetiredResource;
+
+typedef struct
+{
+    RetiredResource *entries;
+    uint32_t count;
+    uint32_t capacity;
+} DeletionQueue;
+
+typedef struct
+{
+    uint32_t blockCount;
+    uint32_t dedicatedBlockCount;
+    uint32_t allocationCount;
+    VkDeviceSize blockBytes;       // total bytes allocated from the driver
+    VkDeviceSize usedBytes;        // bytes handed out to buffers (including padding)
+    VkDeviceSize wastedBytes;      // alignment padding inside used bytes
+    VkDeviceSize freeBytes;        // bytes still available inside blocks
+    VkDeviceSize largestFreeRange; // biggest single allocation that fits without a new block
+    float fragmentation;           // 0 = all free space is one range, close to 1 = free space is shredded
+} GpuAllocatorStats;
+
+static VkDeviceSize alignDeviceSize(VkDeviceSize value, VkDeviceSize alignment)
+{
+    if (alignment <= 1)
+        return value;
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+GpuAllocator *createGpuAllocator(VkDevice device, VkPhysicalDevice physicalDevice)
+{
+    GpuAllocator *allocator = calloc(1, sizeof(GpuAllocator));
+    if (!allocator)
+    {
+        fprintf(stderr, "Failed to allocate memory for the gpu allocator\n");
+        exit(EXIT_FAILURE);
+    }
+
+    allocator->device = device;
+    allocator->physicalDevice = physicalDevice;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &allocator->memoryProperties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    allocator->maxAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+    allocator->nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+    allocator->bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+    pthread_mutex_init(&allocator->mutex, NULL);
+
+    // small heaps (integrated gpus, host visible windows on discrete cards) get smaller blocks
+    for (uint32_t i = 0; i < allocator->memoryProperties.memoryTypeCount; i++)
+    {
+        uint32_t heapIndex = allocator->memoryProperties.memoryTypes[i].heapIndex;
+        VkDeviceSize heapSize = allocator->memoryProperties.memoryHeaps[heapIndex].size;
+        VkDeviceSize blockSize = GPU_MEMORY_PREFERRED_BLOCK_SIZE;
+        if (heapSize / 8 < blockSize)
+            blockSize = alignDeviceSize(heapSize / 8, 1024);
+        allocator->pools[i].blockSize = blockSize;
+    }
+
+    return allocator;
+}
+
+static void insertFreeRange(GpuMemoryBlock *block, uint32_t position, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (block->freeRangeCount == block->freeRangeCapacity)
+    {
+        block->freeRangeCapacity = block->freeRangeCapacity ? block->freeRangeCapacity * 2 : 8;
+        block->freeRanges = realloc(block->freeRanges, sizeof(GpuMemoryRange) * block->freeRangeCapacity);
+        if (!block->freeRanges)
+        {
+            fprintf(stderr, "Failed to grow gpu memory free list\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memmove(&block->freeRanges[position + 1], &block->freeRanges[position], sizeof(GpuMemoryRange) * (block->freeRangeCount - position));
+    block->freeRanges[position].offset = offset;
+    block->freeRanges[position].size = size;
+    block->freeRangeCount++;
+}
+
+static void removeFreeRange(GpuMemoryBlock *block, uint32_t position)
+{
+    memmove(&block->freeRanges[position], &block->freeRanges[position + 1], sizeof(GpuMemoryRange) * (block->freeRangeCount - position - 1));
+    block->freeRangeCount--;
+}
+
+// first fit inside one block, returns false if the block has no range that fits
+static bool allocateFromBlock(GpuMemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation *allocation)
+{
+    for (uint32_t i = 0; i < block->freeRangeCount; i++)
+    {
+        GpuMemoryRange *range = &block->freeRanges[i];
+        VkDeviceSize alignedOffset = alignDeviceSize(range->offset, alignment);
+        VkDeviceSize end = alignedOffset + size;
+        if (end > range->offset + range->size)
+            continue;
+
+        allocation->memory = block->memory;
+        allocation->offset = alignedOffset;
+        allocation->size = size;
+        allocation->rangeOffset = range->offset;
+        allocation->rangeSize = end - range->offset;
+
+        range->size -= allocation->rangeSize;
+        range->offset = end;
+        if (range->size == 0)
+            removeFreeRange(block, i);
+
+        block->usedBytes += allocation->rangeSize;
+        block->paddingBytes += allocation->rangeSize - size;
+        block->allocationCount++;
+        return true;
+    }
+    return false;
+}
+
+static uint32_t createMemoryBlock(GpuAllocator *allocator, uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated)
+{
+    GpuMemoryPool *pool = &allocator->pools[memoryTypeIndex];
+
+    if (allocator->deviceAllocationCount >= allocator->maxAllocationCount)
+    {
+        fprintf(stderr, "Exceeded maxMemoryAllocationCount (%u)\n", allocator->maxAllocationCount);
+        exit(EXIT_FAILURE);
+    }
+
+    // recycle a released slot so block indices held by live allocations stay valid
+    uint32_t blockIndex = pool->blockCount;
+    for (uint32_t i = 0; i < pool->blockCount; i++)
+    {
+        if (pool->blocks[i].memory == VK_NULL_HANDLE)
+        {
+            blockIndex = i;
+            break;
+        }
+    }
+    if (blockIndex == pool->blockCount)
+    {
+        pool->blocks = realloc(pool->blocks, sizeof(GpuMemoryBlock) * (pool->blockCount + 1));
+        if (!pool->blocks)
+        {
+            fprintf(stderr, "Failed to grow gpu memory pool\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(&pool->blocks[blockIndex], 0, sizeof(GpuMemoryBlock));
+        pool->blockCount++;
+    }
+
+    GpuMemoryBlock *block = &pool->blocks[blockIndex];
+
+    VkMemoryAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    if (vkAllocateMemory(allocator->device, &allocInfo, NULL, &block->memory) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate gpu memory block of %llu bytes\n", (unsigned long long)size);
+        exit(EXIT_FAILURE);
+    }
+    allocator->deviceAllocationCount++;
+
+    block->mapped = NULL;
+    if (allocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        void *mapped;
+        if (vkMapMemory(allocator->device, block->memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to map gpu memory block\n");
+            exit(EXIT_FAILURE);
+        }
+        block->mapped = mapped;
+    }
+
+    block->size = size;
+    block->usedBytes = 0;
+    block->paddingBytes = 0;
+    block->allocationCount = 0;
+    block->dedicated = dedicated;
+    block->freeRangeCount = 0;
+    insertFreeRange(block, 0, 0, size);
+
+    return blockIndex;
+}
+
+static void releaseMemoryBlock(GpuAllocator *allocator, GpuMemoryBlock *block)
+{
+    if (block->mapped)
+        vkUnmapMemory(allocator->device, block->memory);
+    block->mapped = NULL;
+    vkFreeMemory(allocator->device, block->memory, NULL);
+    allocator->deviceAllocationCount--;
+    block->memory = VK_NULL_HANDLE;
+    block->size = 0;
+    block->freeRangeCount = 0;
+}
+
+static void setAllocationMapping(GpuAllocator *allocator, GpuAllocation *allocation)
+{
+    GpuMemoryBlock *block = &allocator->pools[allocation->memoryTypeIndex].blocks[allocation->blockIndex];
+    VkMemoryPropertyFlags flags = allocator->memoryProperties.memoryTypes[allocation->memoryTypeIndex].propertyFlags;
+
+    allocation->mapped = block->mapped ? block->mapped + allocation->offset : NULL;
+    allocation->coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+static void allocateLocked(GpuAllocator *allocator, VkMemoryRequirements memRequirements, VkMemoryPropertyFlags properties, GpuAllocation *allocation)
+{
+    uint32_t memoryTypeIndex = findMemoryType(&allocator->memoryProperties, memRequirements.memoryTypeBits, properties);
+    GpuMemoryPool *pool = &allocator->pools[memoryTypeIndex];
+    VkMemoryPropertyFlags flags = allocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+
+    VkDeviceSize size = memRequirements.size;
+    VkDeviceSize alignment = memRequirements.alignment;
+
+    // non coherent ranges are padded out to whole atoms so flushing one allocation never touches its neighbours
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        if (alignment < allocator->nonCoherentAtomSize)
+            alignment = allocator->nonCoherentAtomSize;
+        size = alignDeviceSize(size, allocator->nonCoherentAtomSize);
+    }
+
+    allocation->memoryTypeIndex = memoryTypeIndex;
+
+    // anything bigger than half a block gets its own VkDeviceMemory so it can't strand a mostly empty block
+    if (size > pool->blockSize / 2)
+    {
+        allocation->blockIndex = createMemoryBlock(allocator, memoryTypeIndex, size, true);
+        allocateFromBlock(&pool->blocks[allocation->blockIndex], size, alignment, allocation);
+        setAllocationMapping(allocator, allocation);
+        return;
+    }
+
+    for (uint32_t i = 0; i < pool->blockCount; i++)
+    {
+        GpuMemoryBlock *block = &pool->blocks[i];
+        if (block->memory == VK_NULL_HANDLE || block->dedicated)
+            continue;
+
+        if (allocateFromBlock(block, size, alignment, allocation))
+        {
+            allocation->blockIndex = i;
+            setAllocationMapping(allocator, allocation);
+            return;
+        }
+    }
+
+    allocation->blockIndex = createMemoryBlock(allocator, memoryTypeIndex, pool->blockSize, false);
+    allocateFromBlock(&pool->blocks[allocation->blockIndex], size, alignment, allocation);
+    setAllocationMapping(allocator, allocation);
+}
+
+void gpuAllocate(GpuAllocator *allocator, VkMemoryRequirements memRequirements, VkMemoryPropertyFlags properties, GpuAllocation *allocation)
+{
+    pthread_mutex_lock(&allocator->mutex);
+    allocateLocked(allocator, memRequirements, properties, allocation);
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+// optimal tiling images are padded to whole bufferImageGranularity pages on both ends, so they can sit in the
+// same blocks as buffers without aliasing a page with one
+void gpuAllocateImage(GpuAllocator *allocator, VkImage image, VkMemoryPropertyFlags properties, GpuAllocation *allocation)
+{
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(allocator->device, image, &memRequirements);
+
+    if (memRequirements.alignment < allocator->bufferImageGranularity)
+        memRequirements.alignment = allocator->bufferImageGranularity;
+    memRequirements.size = alignDeviceSize(memRequirements.size, allocator->bufferImageGranularity);
+
+    gpuAllocate(allocator, memRequirements, properties, allocation);
+
+    vkBindImageMemory(allocator->device, image, allocation->memory, allocation->offset);
+}
+
+// makes cpu writes to [offset, offset + size) of the allocation visible to the gpu, a no-op on coherent memory
+void gpuFlushAllocation(GpuAllocator *allocator, const GpuAllocation *allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (allocation->coherent || size == 0)
+        return;
+
+    pthread_mutex_lock(&allocator->mutex);
+    VkDeviceSize blockSize = allocator->pools[allocation->memoryTypeIndex].blocks[allocation->blockIndex].size;
+    pthread_mutex_unlock(&allocator->mutex);
+
+    VkDeviceSize atom = allocator->nonCoherentAtomSize;
+    VkDeviceSize start = (allocation->offset + offset) / atom * atom;
+    VkDeviceSize end = alignDeviceSize(allocation->offset + offset + size, atom);
+    if (end > blockSize)
+        end = blockSize;
+
+    VkMappedMemoryRange range = {0};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation->memory;
+    range.offset = start;
+    range.size = end - start;
+    vkFlushMappedMemoryRanges(allocator->device, 1, &range);
+}
+
+// memcpy into the persistent mapping plus the flush non coherent memory needs
+void copyDataToDeviceMemory(GpuAllocator *allocator, const GpuAllocation *allocation, VkDeviceSize offset, const void *data, VkDeviceSize size)
+{
+    if (!allocation->mapped)
+    {
+        fprintf(stderr, "Tried to write to gpu memory that is not host visible\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy((char *)allocation->mapped + offset, data, size);
+    gpuFlushAllocation(allocator, allocation, offset, size);
+}
+
+static void freeLocked(GpuAllocator *allocator, GpuAllocation *allocation)
+{
+    GpuMemoryPool *pool = &allocator->pools[allocation->memoryTypeIndex];
+    GpuMemoryBlock *block = &pool->blocks[allocation->blockIndex];
+
+    block->usedBytes -= allocation->rangeSize;
+    block->paddingBytes -= allocation->rangeSize - allocation->size;
+    block->allocationCount--;
+
+    // find the insert position and merge with the neighbouring free ranges
+    VkDeviceSize offset = allocation->rangeOffset;
+    VkDeviceSize size = allocation->rangeSize;
+    uint32_t position = 0;
+    while (position < block->freeRangeCount && block->freeRanges[position].offset < offset)
+        position++;
+
+    bool mergePrevious = position > 0 && block->freeRanges[position - 1].offset + block->freeRanges[position - 1].size == offset;
+    bool mergeNext = position < block->freeRangeCount && offset + size == block->freeRanges[position].offset;
+
+    if (mergePrevious && mergeNext)
+    {
+        block->freeRanges[position - 1].size += size + block->freeRanges[position].size;
+        removeFreeRange(block, position);
+    }
+    else if (mergePrevious)
+    {
+        block->freeRanges[position - 1].size += size;
+    }
+    else if (mergeNext)
+    {
+        block->freeRanges[position].offset = offset;
+        block->freeRanges[position].size += size;
+    }
+    else
+    {
+        insertFreeRange(block, position, offset, size);
+    }
+
+    // give empty blocks back to the driver, but keep one shared block around so add/remove doesn't thrash
+    if (block->allocationCount == 0)
+    {
+        bool keep = false;
+        if (!block->dedicated)
+        {
+            keep = true;
+            for (uint32_t i = 0; i < pool->blockCount; i++)
+            {
+                if (&pool->blocks[i] != block && pool->blocks[i].memory != VK_NULL_HANDLE && !pool->blocks[i].dedicated)
+                {
+                    keep = false;
+                    break;
+                }
+            }
+        }
+        if (!keep)
+            releaseMemoryBlock(allocator, block);
+    }
+
+    memset(allocation, 0, sizeof(GpuAllocation));
+}
+
+void gpuFree(GpuAllocator *allocator, GpuAllocation *allocation)
+{
+    if (allocation->memory == VK_NULL_HANDLE)
+        return;
+
+    pthread_mutex_lock(&allocator->mutex);
+    freeLocked(allocator, allocation);
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+void getGpuAllocatorStats(GpuAllocator *allocator, GpuAllocatorStats *stats)
+{
+    memset(stats, 0, sizeof(GpuAllocatorStats));
+    pthread_mutex_lock(&allocator->mutex);
+
+    for (uint32_t t = 0; t < allocator->memoryProperties.memoryTypeCount; t++)
+    {
+        const GpuMemoryPool *pool = &allocator->pools[t];
+        for (uint32_t b = 0; b < pool->blockCount; b++)
+        {
+            const GpuMemoryBlock *block = &pool->blocks[b];
+            if (block->memory == VK_NULL_HANDLE)
+                continue;
+
+            stats->blockCount++;
+            if (block->dedicated)
+                stats->dedicatedBlockCount++;
+            stats->allocationCount += block->allocationCount;
+            stats->blockBytes += block->size;
+            stats->usedBytes += block->usedBytes;
+            stats->wastedBytes += block->paddingBytes;
+
+            for (uint32_t r = 0; r < block->freeRangeCount; r++)
+            {
+                stats->freeBytes += block->freeRanges[r].size;
+                if (block->freeRanges[r].size > stats->largestFreeRange)
+                    stats->largestFreeRange = block->freeRanges[r].size;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&allocator->mutex);
+
+    if (stats->freeBytes > 0)
+        stats->fragmentation = 1.0f - (float)stats->largestFreeRange / (float)stats->freeBytes;
+}
+
+void printGpuAllocatorStats(GpuAllocator *allocator)
+{
+    GpuAllocatorStats stats;
+    getGpuAllocatorStats(allocator, &stats);
+
+    printf("gpu memory: %u blocks (%u dedicated), %u allocations, %.2f MiB reserved, %.2f MiB used, %llu bytes wasted to alignment, %.1f%% fragmented\n",
+           stats.blockCount, stats.dedicatedBlockCount, stats.allocationCount,
+           stats.blockBytes / (1024.0 * 1024.0), stats.usedBytes / (1024.0 * 1024.0),
+           (unsigned long long)stats.wastedBytes, stats.fragmentation * 100.0f);
+}
+
+void destroyGpuAllocator(GpuAllocator *allocator)
+{
+    for (uint32_t t = 0; t < allocator->memoryProperties.memoryTypeCount; t++)
+    {
+        GpuMemoryPool *pool = &allocator->pools[t];
+        for (uint32_t b = 0; b < pool->blockCount; b++)
+        {
+            if (pool->blocks[b].memory != VK_NULL_HANDLE)
+            {
+                if (pool->blocks[b].allocationCount > 0)
+                    fprintf(stderr, "gpu memory block %u of type %u still has %u live allocations\n", b, t, pool->blocks[b].allocationCount);
+                releaseMemoryBlock(allocator, &pool->blocks[b]);
+            }
+            free(pool->blocks[b].freeRanges);
+        }
+        free(pool->blocks);
+    }
+    pthread_mutex_destroy(&allocator->mutex);
+    free(allocator);
+}
+
+static RetiredResource *pushRetiredResource(DeletionQueue *queue, uint64_t frameNumber, RetiredResourceType type)
+{
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 8;
+        queue->entries = realloc(queue->entries, sizeof(RetiredResource) * queue->capacity);
+        if (!queue->entries)
+        {
+            fprintf(stderr, "Failed to grow deletion queue\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    RetiredResource *entry = &queue->entries[queue->count++];
+    entry->type = type;
+    entry->frameNumber = frameNumber;
+    return entry;
+}
+
+void deferBufferDestruction(DeletionQueue *queue, uint64_t frameNumber, VkBuffer buffer, const GpuAllocation *allocation)
+{
+    RetiredResource *entry = pushRetiredResource(queue, frameNumber, RETIRED_BUFFER);
+    entry->buffer = buffer;
+    entry->allocation = *allocation;
+}
+
+void deferImageViewDestruction(DeletionQueue *queue, uint64_t frameNumber, VkImageView imageView)
+{
+    pushRetiredResource(queue, frameNumber, RETIRED_IMAGE_VIEW)->imageView = imageView;
+}
+
+void deferFramebufferDestruction(DeletionQueue *queue, uint64_t frameNumber, VkFramebuffer framebuffer)
+{
+    pushRetiredResource(queue, frameNumber, RETIRED_FRAMEBUFFER)->framebuffer = framebuffer;
+}
+
+void deferSemaphoreDestruction(DeletionQueue *queue, uint64_t frameNumber, VkSemaphore semaphore)
+{
+    pushRetiredResource(queue, frameNumber, RETIRED_SEMAPHORE)->semaphore = semaphore;
+}
+
+void deferSwapchainDestruction(DeletionQueue *queue, uint64_t frameNumber, VkSwapchainKHR swapchain)
+{
+    pushRetiredResource(queue, frameNumber, RETIRED_SWAPCHAIN)->swapchain = swapchain;
+}
+
+static void destroyRetiredResource(GpuAllocator *allocator, RetiredResource *entry)
+{
+    VkDevice device = allocator->device;
+
+    switch (entry->type)
+    {
+    case RETIRED_BUFFER:
+        vkDestroyBuffer(device, entry->buffer, NULL);
+        gpuFree(allocator, &entry->allocation);
+        break;
+    case RETIRED_IMAGE_VIEW:
+        vkDestroyImageView(device, entry->imageView, NULL);
+        break;
+    case RETIRED_FRAMEBUFFER:
+        vkDestroyFramebuffer(device, entry->framebuffer, NULL);
+        break;
+    case RETIRED_SEMAPHORE:
+        vkDestroySemaphore(device, entry->semaphore, NULL);
+        break;
+    case RETIRED_SWAPCHAIN:
+        vkDestroySwapchainKHR(device, entry->swapchain, NULL);
+        break;
+    }
+}
+
+// destroys everything retired during or before completedFrame (the newest frame whose fence we have waited on)
+void flushDeletionQueue(DeletionQueue *queue, GpuAllocator *allocator, uint64_t completedFrame)
+{
+    // entries are destroyed in the order they were retired, so views and framebuffers go before their swapchain
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < queue->count; i++)
+    {
+        RetiredResource *entry = &queue->entries[i];
+        if (entry->frameNumber <= completedFrame)
+        {
+            destroyRetiredResource(allocator, entry);
+        }
+        else
+        {
+            queue->entries[kept++] = *entry;
+        }
+    }
+    queue->count = kept;
+}
+
+void destroyDeletionQueue(DeletionQueue *queue, GpuAllocator *allocator)
+{
+    flushDeletionQueue(queue, allocator, UINT64_MAX);
+    free(queue->entries);
+    queue->entries = NULL;
+    queue->capacity = 0;
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mymappedfile.c"
+#include "myvertex.c"
+
+// cooked mesh files: what loadGltfMeshes builds out of a gltf, stored the way the gpu wants it so a load is one
+// mapping and a few staging uploads, no json and no accessor conversion. written offline by tests/cooker.c.
+// layout: MeshFileHeader, then the packed vertices (myvertex.c), the 16-bit indices, the 32-bit indices and the MeshFileRanges,
+// each section starting MESH_FILE_ALIGNMENT aligned at the offset the header gives. little endian throughout.
+// bump MESH_FILE_VERSION on any layout change, old files are then rejected and the gltf is loaded instead.
+
+#define MESH_FILE_MAGIC 0x4853454Du // "MESH"
+#define MESH_FILE_VERSION 2u
+#define MESH_FILE_ALIGNMENT 64
+#define MESH_FILE_EXTENSION ".mesh" // appended to the gltf path: scene.gltf -> scene.gltf.mesh
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexStride; // sizeof(Vertex): a float position (12) in version 1, a packed Vertex (24) since version 2
+    uint32_t rangeCount;
+    uint64_t vertexCount;
+    uint64_t indexCount16;
+    uint64_t indexCount32;
+    uint64_t vertexOffset; // section offsets from the start of the file
+    uint64_t index16Offset;
+    uint64_t index32Offset;
+    uint64_t rangeOffset;
+    uint64_t fileSize; // catches truncated files
+    float boundsMin[3]; // of every position in the file
+    float boundsMax[3];
+} MeshFileHeader;
+
+// one per gltf primitive, in gltf order
+typedef struct
+{
+    uint32_t firstIndex; // into the section of its index size
+    uint32_t indexCount;
+    int32_t vertexOffset; // added to every index of the range
+    uint32_t indexSize;   // 2 or 4
+    int32_t material;     // index into the gltf materials, -1 without one
+    float boundsMin[3];
+    float boundsMax[3];
+} MeshFileRange;
+
+typedef struct
+{
+    MappedFile file;
+    const MeshFileHeader *header;
+    const Vertex *vertices;
+    const uint16_t *indices16;
+    const uint32_t *indices32;
+    const MeshFileRange *ranges;
+} MeshFile;
+
+static uint64_t alignMeshFileOffset(uint64_t offset)
+{
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(uint64_t)(MESH_FILE_ALIGNMENT - 1);
+}
+
+static bool meshFileSectionFits(const MeshFileHeader *header, uint64_t offset, uint64_t size)
+{
+    return offset % MESH_FILE_ALIGNMENT == 0 && offset <= header->fileSize && size <= header->fileSize - offset;
+}
+
+// a range has to stay inside its index section and draw from the file's vertices, a corrupt one would turn into
+// out of bounds draws on the gpu
+static bool meshFileRangeFits(const MeshFileHeader *header, const MeshFileRange *range)
+{
+    if (range->indexSize != sizeof(uint16_t) && range->indexSize != sizeof(uint32_t))
+        return false;
+    uint64_t sectionCount = range->indexSize == sizeof(uint16_t) ? header->indexCount16 : header->indexCount32;
+    return (uint64_t)range->firstIndex + range->indexCount <= sectionCount &&
+           range->vertexOffset >= 0 && (uint64_t)range->vertexOffset < header->vertexCount;
+}
+
+// false when there is no such file, or when it is not a valid cooked mesh of this version (says why on stderr)
+bool openMeshFile(const char *path, MeshFile *meshFile)
+{
+    *meshFile = (MeshFile){0};
+    if (!mapFile(path, &meshFile->file))
+        return false;
+
+    const MeshFileHeader *header = meshFile->file.data;
+    const char *base = meshFile->file.data;
+
+    bool valid = meshFile->file.size >= sizeof(MeshFileHeader) &&
+                 header->magic == MESH_FILE_MAGIC &&
+                 header->version == MESH_FILE_VERSION &&
+                 header->vertexStride == sizeof(Vertex) &&
+                 header->fileSize == meshFile->file.size &&
+                 meshFileSectionFits(header, header->vertexOffset, header->vertexCount * header->vertexStride) &&
+                 meshFileSectionFits(header, header->index16Offset, header->indexCount16 * sizeof(uint16_t)) &&
+                 meshFileSectionFits(header, header->index32Offset, header->indexCount32 * sizeof(uint32_t)) &&
+                 meshFileSectionFits(header, header->rangeOffset, (uint64_t)header->rangeCount * sizeof(MeshFileRange));
+    if (!valid)
+    {
+        fprintf(stderr, "%s is not a cooked mesh of version %u, cook it again\n", path, MESH_FILE_VERSION);
+        unmapFile(&meshFile->file);
+        return false;
+    }
+
+    const MeshFileRange *ranges = (const MeshFileRange *)(base + header->rangeOffset);
+    for (uint32_t i = 0; i < header->rangeCount; i++)
+    {
+        if (!meshFileRangeFits(header, &ranges[i]))
+        {
+            fprintf(stderr, "%s: range %u is outside the file's indices or vertices, cook it again\n", path, i);
+            unmapFile(&meshFile->file);
+            return false;
+        }
+    }
+
+    meshFile->header = header;
+    meshFile->vertices = (const Vertex *)(base + header->vertexOffset);
+    meshFile->indices16 = (const uint16_t *)(base + header->index16Offset);
+    meshFile->indices32 = (const uint32_t *)(base + header->index32Offset);
+    meshFile->ranges = ranges;
+    return true;
+}
+
+void closeMeshFile(MeshFile *meshFile)
+{
+    unmapFile(&meshFile->file);
+    *meshFile = (MeshFile){0};
+}
+
+static bool writeMeshFileSection(FILE *file, uint64_t *position, uint64_t offset, const void *data, uint64_t size)
+{
+    static const char padding[MESH_FILE_ALIGNMENT] = {0};
+    bool written = fwrite(padding, 1, offset - *position, file) == offset - *position;
+    if (size > 0)
+        written = fwrite(data, 1, size, file) == size && written;
+    *position = offset + size;
+    return written;
+}
+
+// header only needs the counts and the bounds filled in, the offsets and the size are laid out here.
+// written to path.tmp and moved into place, a crashed cooker never leaves a half written file behind
+bool writeMeshFile(const char *path, MeshFileHeader header, const Vertex *vertices, const uint16_t *indices16,
+                   const uint32_t *indices32, const MeshFileRange *ranges)
+{
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.vertexStride = sizeof(Vertex);
+    header.vertexOffset = alignMeshFileOffset(sizeof(MeshFileHeader));
+    header.index16Offset = alignMeshFileOffset(header.vertexOffset + header.vertexCount * header.vertexStride);
+    header.index32Offset = alignMeshFileOffset(header.index16Offset + header.indexCount16 * sizeof(uint16_t));
+    header.rangeOffset = alignMeshFileOffset(header.index32Offset + header.indexCount32 * sizeof(uint32_t));
+    header.fileSize = header.rangeOffset + (uint64_t)header.rangeCount * sizeof(MeshFileRange);
+
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *file = fopen(tempPath, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", tempPath);
+        return false;
+    }
+
+    uint64_t position = 0;
+    bool written = writeMeshFileSection(file, &position, 0, &header, sizeof(header)) &&
+                   writeMeshFileSection(file, &position, header.vertexOffset, vertices, header.vertexCount * header.vertexStride) &&
+                   writeMeshFileSection(file, &position, header.index16Offset, indices16, header.indexCount16 * sizeof(uint16_t)) &&
+                   writeMeshFileSection(file, &position, header.index32Offset, indices32, header.indexCount32 * sizeof(uint32_t)) &&
+                   writeMeshFileSection(file, &position, header.rangeOffset, ranges, (uint64_t)header.rangeCount * sizeof(MeshFileRange));
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write %s\n", tempPath);
+        remove(tempPath);
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(path); // rename does not replace an existing file on windows
+#endif
+    if (rename(tempPath, path) != 0)
+    {
+        fprintf(stderr, "Failed to move %s into place at %s\n", tempPath, path);
+        remove(tempPath);
+        return false;
+    }
+    return true;
+}
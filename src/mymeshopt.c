@@ -0,0 +1,429 @@
+#pragma once
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "myvertex.c"
+
+// offline mesh optimization for the cooker (tests/cooker.c), on one primitive at a time, indices local to it:
+//   optimizeVertexCache  triangles reordered for post transform cache hits (tipsify, Sander et al. 2007)
+//   optimizeOverdraw     clusters of the cache optimized order sorted so outward facing ones come first, view independent
+//   optimizeVertexFetch  vertices renumbered in the order the indices first use them
+// run in that order, the overdraw pass keeps the order inside clusters and so most of the cache gains.
+// analyzeVertexCache measures a fifo cache of MESH_OPT_CACHE_SIZE entries, acmr (misses per triangle, 0.5 at best
+// on closed meshes, 3 at worst) and atvr (misses per vertex, 1 at best)
+
+#define MESH_OPT_CACHE_SIZE 16
+#define MESH_OPT_OVERDRAW_THRESHOLD 1.05f // clusters may get this much worse acmr than their tipsify run
+
+typedef struct
+{
+    uint64_t triangleCount;
+    uint64_t vertexCount; // referenced by at least one triangle
+    uint64_t missCount;
+} VertexCacheStats;
+
+static void *allocateMeshOpt(size_t size)
+{
+    void *memory = malloc(size > 0 ? size : 1);
+    if (!memory)
+    {
+        fprintf(stderr, "Failed to allocate %zu bytes for mesh optimization\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+// timestamps make an exact fifo: a vertex is cached when it missed within the last cacheSize misses.
+// returns the misses of the triangle
+static uint32_t updateCache(const uint32_t *triangle, uint32_t *timestamps, uint32_t *timestamp, uint32_t cacheSize)
+{
+    uint32_t misses = 0;
+    for (int corner = 0; corner < 3; corner++)
+    {
+        uint32_t vertex = triangle[corner];
+        if (*timestamp - timestamps[vertex] > cacheSize)
+        {
+            timestamps[vertex] = (*timestamp)++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+// adds a primitive to stats, call it for several to get a whole mesh
+void analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount, VertexCacheStats *stats)
+{
+    uint32_t *timestamps = calloc(vertexCount > 0 ? vertexCount : 1, sizeof(uint32_t));
+    bool *referenced = calloc(vertexCount > 0 ? vertexCount : 1, sizeof(bool));
+    if (!timestamps || !referenced)
+    {
+        fprintf(stderr, "Failed to allocate vertex cache analysis of %zu vertices\n", vertexCount);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t timestamp = MESH_OPT_CACHE_SIZE + 1;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        stats->missCount += updateCache(&indices[i], timestamps, &timestamp, MESH_OPT_CACHE_SIZE);
+        stats->triangleCount++;
+    }
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        stats->vertexCount += !referenced[indices[i]];
+        referenced[indices[i]] = true;
+    }
+
+    free(timestamps);
+    free(referenced);
+}
+
+double getAcmr(const VertexCacheStats *stats)
+{
+    return stats->triangleCount > 0 ? (double)stats->missCount / stats->triangleCount : 0.0;
+}
+
+double getAtvr(const VertexCacheStats *stats)
+{
+    return stats->vertexCount > 0 ? (double)stats->missCount / stats->vertexCount : 0.0;
+}
+
+// the triangles of every vertex, triangleOffsets[v] to triangleOffsets[v + 1] in triangles
+typedef struct
+{
+    uint32_t *triangleOffsets;
+    uint32_t *triangles;
+} VertexTriangles;
+
+static VertexTriangles buildVertexTriangles(const uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+    VertexTriangles adjacency;
+    adjacency.triangleOffsets = calloc(vertexCount + 1, sizeof(uint32_t));
+    adjacency.triangles = allocateMeshOpt(sizeof(uint32_t) * indexCount);
+    if (!adjacency.triangleOffsets)
+    {
+        fprintf(stderr, "Failed to allocate the adjacency of %zu vertices\n", vertexCount);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        adjacency.triangleOffsets[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        adjacency.triangleOffsets[v + 1] += adjacency.triangleOffsets[v];
+    }
+
+    // filled through a copy of the offsets used as write cursors
+    uint32_t *cursors = allocateMeshOpt(sizeof(uint32_t) * vertexCount);
+    memcpy(cursors, adjacency.triangleOffsets, sizeof(uint32_t) * vertexCount);
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        adjacency.triangles[cursors[indices[i]]++] = (uint32_t)(i / 3);
+    }
+    free(cursors);
+    return adjacency;
+}
+
+// tipsify: fans around one vertex at a time, the next fan vertex is the candidate that stays in the cache longest
+// once its remaining triangles are emitted. runs out of candidates at dead ends, then takes the most recently used
+// vertex that still has triangles, or the next one in index order
+void optimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return;
+
+    VertexTriangles adjacency = buildVertexTriangles(indices, triangleCount * 3, vertexCount);
+    uint32_t *liveCounts = allocateMeshOpt(sizeof(uint32_t) * vertexCount);
+    uint32_t *timestamps = calloc(vertexCount, sizeof(uint32_t));
+    uint32_t *deadEnds = allocateMeshOpt(sizeof(uint32_t) * triangleCount * 3);
+    uint32_t *candidates = allocateMeshOpt(sizeof(uint32_t) * triangleCount * 3); // of the current fan
+    bool *emitted = calloc(triangleCount, sizeof(bool));
+    uint32_t *result = allocateMeshOpt(sizeof(uint32_t) * triangleCount * 3);
+    if (!timestamps || !emitted)
+    {
+        fprintf(stderr, "Failed to allocate the vertex cache optimization of %zu vertices\n", vertexCount);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        liveCounts[v] = adjacency.triangleOffsets[v + 1] - adjacency.triangleOffsets[v];
+    }
+
+    const uint32_t cacheSize = MESH_OPT_CACHE_SIZE;
+    uint32_t timestamp = cacheSize + 1;
+    size_t deadEndCount = 0;
+    size_t resultCount = 0;
+    size_t cursor = 0; // every vertex before it has no live triangles left
+    int64_t fan = 0;
+
+    while (fan >= 0)
+    {
+        size_t candidateCount = 0;
+        for (uint32_t k = adjacency.triangleOffsets[fan]; k < adjacency.triangleOffsets[fan + 1]; k++)
+        {
+            uint32_t triangle = adjacency.triangles[k];
+            if (emitted[triangle])
+                continue;
+
+            for (int corner = 0; corner < 3; corner++)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                result[resultCount++] = vertex;
+                deadEnds[deadEndCount++] = vertex;
+                candidates[candidateCount++] = vertex;
+                liveCounts[vertex]--;
+                if (timestamp - timestamps[vertex] > cacheSize)
+                    timestamps[vertex] = timestamp++;
+            }
+            emitted[triangle] = true;
+        }
+
+        // the candidate whose triangles can all be emitted before it leaves the cache, the oldest such one first
+        fan = -1;
+        int64_t bestPriority = -1;
+        for (size_t c = 0; c < candidateCount; c++)
+        {
+            uint32_t vertex = candidates[c];
+            if (liveCounts[vertex] == 0)
+                continue;
+
+            int64_t priority = 0;
+            if ((int64_t)(timestamp - timestamps[vertex]) + 2 * (int64_t)liveCounts[vertex] <= cacheSize)
+                priority = timestamp - timestamps[vertex];
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                fan = vertex;
+            }
+        }
+
+        while (fan < 0 && deadEndCount > 0)
+        {
+            uint32_t vertex = deadEnds[--deadEndCount];
+            if (liveCounts[vertex] > 0)
+                fan = vertex;
+        }
+        while (fan < 0 && cursor < vertexCount)
+        {
+            if (liveCounts[cursor] > 0)
+                fan = (int64_t)cursor;
+            cursor++;
+        }
+    }
+
+    memcpy(indices, result, sizeof(uint32_t) * triangleCount * 3);
+
+    free(adjacency.triangleOffsets);
+    free(adjacency.triangles);
+    free(liveCounts);
+    free(timestamps);
+    free(deadEnds);
+    free(candidates);
+    free(emitted);
+    free(result);
+}
+
+typedef struct
+{
+    uint32_t firstTriangle;
+    uint32_t triangleCount;
+    float sortKey;
+} OverdrawCluster;
+
+static int compareOverdrawClusters(const void *a, const void *b)
+{
+    const OverdrawCluster *x = a;
+    const OverdrawCluster *y = b;
+    if (x->sortKey != y->sortKey)
+        return x->sortKey < y->sortKey ? 1 : -1; // descending
+    return (x->firstTriangle > y->firstTriangle) - (x->firstTriangle < y->firstTriangle);
+}
+
+// cluster boundaries, as triangle numbers ending with triangleCount. a hard boundary is a triangle that misses on
+// all three vertices (tipsify jumped somewhere else), inside those a cluster ends as soon as its own acmr is within
+// threshold of the acmr of the whole run, so clusters stay small where the order caches well
+static size_t findClusterBoundaries(const uint32_t *indices, size_t triangleCount, size_t vertexCount, float threshold, uint32_t *boundaries)
+{
+    uint32_t *timestamps = calloc(vertexCount, sizeof(uint32_t));
+    if (!timestamps)
+    {
+        fprintf(stderr, "Failed to allocate the overdraw clusters of %zu vertices\n", vertexCount);
+        exit(EXIT_FAILURE);
+    }
+
+    const uint32_t cacheSize = MESH_OPT_CACHE_SIZE;
+    uint32_t timestamp = cacheSize + 1;
+    size_t hardCount = 0;
+    uint32_t *hard = allocateMeshOpt(sizeof(uint32_t) * (triangleCount + 1));
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        if (updateCache(&indices[t * 3], timestamps, &timestamp, cacheSize) == 3 || t == 0)
+            hard[hardCount++] = (uint32_t)t;
+    }
+    hard[hardCount] = (uint32_t)triangleCount;
+
+    size_t boundaryCount = 0;
+    for (size_t h = 0; h < hardCount; h++)
+    {
+        uint32_t start = hard[h], end = hard[h + 1];
+
+        // a fresh cache per run, timestamps only ever grow so jumping past cacheSize empties it
+        timestamp += cacheSize + 1;
+        uint32_t runMisses = 0;
+        for (uint32_t t = start; t < end; t++)
+        {
+            runMisses += updateCache(&indices[t * 3], timestamps, &timestamp, cacheSize);
+        }
+        float runThreshold = threshold * (float)runMisses / (float)(end - start);
+
+        boundaries[boundaryCount++] = start;
+        timestamp += cacheSize + 1;
+        uint32_t misses = 0, triangles = 0;
+        for (uint32_t t = start; t < end; t++)
+        {
+            misses += updateCache(&indices[t * 3], timestamps, &timestamp, cacheSize);
+            triangles++;
+            if ((float)misses / (float)triangles <= runThreshold && t + 1 < end)
+            {
+                boundaries[boundaryCount++] = t + 1;
+                timestamp += cacheSize + 1;
+                misses = 0;
+                triangles = 0;
+            }
+        }
+    }
+    boundaries[boundaryCount] = (uint32_t)triangleCount;
+
+    free(hard);
+    free(timestamps);
+    return boundaryCount;
+}
+
+// splits the (cache optimized) order into clusters and sorts them by how far they face away from the middle of the
+// primitive: dot(cluster centroid - primitive centroid, cluster normal), largest first. outer surfaces are drawn
+// before what they hide from most directions, without a view to sort for (Sander et al. 2007)
+void optimizeOverdraw(uint32_t *indices, size_t indexCount, const Vertex *vertices, size_t vertexCount, float threshold)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return;
+
+    uint32_t *boundaries = allocateMeshOpt(sizeof(uint32_t) * (triangleCount + 1));
+    size_t clusterCount = findClusterBoundaries(indices, triangleCount, vertexCount, threshold, boundaries);
+
+    // area weighted centroids, the cross products are twice the triangle areas along the normals
+    float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    OverdrawCluster *clusters = allocateMeshOpt(sizeof(OverdrawCluster) * clusterCount);
+    float (*clusterCentroids)[3] = allocateMeshOpt(sizeof(float[3]) * clusterCount);
+    float (*clusterNormals)[3] = allocateMeshOpt(sizeof(float[3]) * clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        float centroid[3] = {0.0f, 0.0f, 0.0f}, normal[3] = {0.0f, 0.0f, 0.0f};
+        float area = 0.0f;
+        for (uint32_t t = boundaries[c]; t < boundaries[c + 1]; t++)
+        {
+            const float *p0 = vertices[indices[t * 3 + 0]].inPosition;
+            const float *p1 = vertices[indices[t * 3 + 1]].inPosition;
+            const float *p2 = vertices[indices[t * 3 + 2]].inPosition;
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float cross[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float triangleArea = sqrtf(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                centroid[axis] += (p0[axis] + p1[axis] + p2[axis]) / 3.0f * triangleArea;
+                normal[axis] += cross[axis];
+            }
+            area += triangleArea;
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            meshCentroid[axis] += centroid[axis];
+            clusterCentroids[c][axis] = area > 0.0f ? centroid[axis] / area : 0.0f;
+            clusterNormals[c][axis] = normal[axis];
+        }
+        meshArea += area;
+        clusters[c] = (OverdrawCluster){boundaries[c], boundaries[c + 1] - boundaries[c], 0.0f};
+    }
+
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        const float *normal = clusterNormals[c];
+        float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float middle = meshArea > 0.0f ? meshCentroid[axis] / meshArea : 0.0f;
+            key += (clusterCentroids[c][axis] - middle) * (length > 0.0f ? normal[axis] / length : 0.0f);
+        }
+        clusters[c].sortKey = key;
+    }
+
+    qsort(clusters, clusterCount, sizeof(OverdrawCluster), compareOverdrawClusters);
+
+    uint32_t *result = allocateMeshOpt(sizeof(uint32_t) * triangleCount * 3);
+    size_t resultCount = 0;
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        memcpy(&result[resultCount], &indices[clusters[c].firstTriangle * 3], sizeof(uint32_t) * clusters[c].triangleCount * 3);
+        resultCount += clusters[c].triangleCount * 3;
+    }
+    memcpy(indices, result, sizeof(uint32_t) * resultCount);
+
+    free(result);
+    free(clusterNormals);
+    free(clusterCentroids);
+    free(clusters);
+    free(boundaries);
+}
+
+// vertices move to where the index order first uses them, so fetches walk the vertex buffer forward. vertices no
+// triangle uses go to the end, the vertex count stays the same
+void optimizeVertexFetch(uint32_t *indices, size_t indexCount, Vertex *vertices, size_t vertexCount)
+{
+    if (vertexCount == 0)
+        return;
+
+    uint32_t *remap = allocateMeshOpt(sizeof(uint32_t) * vertexCount);
+    memset(remap, 0xff, sizeof(uint32_t) * vertexCount);
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (remap[indices[i]] == UINT32_MAX)
+            remap[indices[i]] = next++;
+        indices[i] = remap[indices[i]];
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (remap[v] == UINT32_MAX)
+            remap[v] = next++;
+    }
+
+    Vertex *reordered = allocateMeshOpt(sizeof(Vertex) * vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        reordered[remap[v]] = vertices[v];
+    }
+    memcpy(vertices, reordered, sizeof(Vertex) * vertexCount);
+
+    free(reordered);
+    free(remap);
+}
+
+// the three passes in order on a triangle list primitive
+void optimizeMesh(uint32_t *indices, size_t indexCount, Vertex *vertices, size_t vertexCount)
+{
+    optimizeVertexCache(indices, indexCount, vertexCount);
+    optimizeOverdraw(indices, indexCount, vertices, vertexCount, MESH_OPT_OVERDRAW_THRESHOLD);
+    optimizeVertexFetch(indices, indexCount, vertices, vertexCount);
+}
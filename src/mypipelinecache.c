@@ -0,0 +1,205 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// pipeline cache persisted between runs. the file is our header followed by the driver's cache blob:
+//   magic, format version, vendorID, deviceID, pipelineCacheUUID -> a cache from another gpu/driver is ignored
+//   coldCreateSeconds -> how long pipeline creation took without a cache, to report what a warm start saved
+// the file is written to a temporary name and renamed over the old one so a crash never leaves half a cache.
+
+#define PIPELINE_CACHE_PATH "./pipeline_cache.bin"
+#define PIPELINE_CACHE_MAGIC 0x43505556u // "VUPC"
+#define PIPELINE_CACHE_FORMAT_VERSION 1u
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t formatVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    double coldCreateSeconds;
+} PipelineCacheFileHeader;
+
+typedef struct
+{
+    VkPipelineCache cache;
+    VkPhysicalDeviceProperties deviceProperties;
+    bool warm;                // started from a valid file
+    double coldCreateSeconds; // pipeline creation time without a cache, 0 until known
+} PipelineCache;
+
+// reads path and returns the blob when the header matches this device, NULL otherwise
+static void *readPipelineCacheFile(const char *path, const VkPhysicalDeviceProperties *properties, size_t *dataSize, double *coldCreateSeconds)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    PipelineCacheFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    if (header.magic != PIPELINE_CACHE_MAGIC || header.formatVersion != PIPELINE_CACHE_FORMAT_VERSION ||
+        header.vendorID != properties->vendorID || header.deviceID != properties->deviceID ||
+        memcmp(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+        header.dataSize == 0)
+    {
+        printf("pipeline cache %s is from another device or driver, ignoring it\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    void *data = malloc((size_t)header.dataSize);
+    if (!data || fread(data, 1, (size_t)header.dataSize, file) != header.dataSize)
+    {
+        fprintf(stderr, "Pipeline cache %s is truncated, ignoring it\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    // the blob carries the driver's own header too, check it agrees before handing it over
+    VkPipelineCacheHeaderVersionOne blobHeader;
+    if (header.dataSize < sizeof(blobHeader))
+    {
+        free(data);
+        return NULL;
+    }
+    memcpy(&blobHeader, data, sizeof(blobHeader));
+    if (blobHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        blobHeader.vendorID != properties->vendorID || blobHeader.deviceID != properties->deviceID ||
+        memcmp(blobHeader.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        printf("pipeline cache %s holds a blob for another device, ignoring it\n", path);
+        free(data);
+        return NULL;
+    }
+
+    *dataSize = (size_t)header.dataSize;
+    *coldCreateSeconds = header.coldCreateSeconds;
+    return data;
+}
+
+PipelineCache loadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const char *path)
+{
+    PipelineCache pipelineCache = {0};
+    vkGetPhysicalDeviceProperties(physicalDevice, &pipelineCache.deviceProperties);
+
+    size_t dataSize = 0;
+    void *data = readPipelineCacheFile(path, &pipelineCache.deviceProperties, &dataSize, &pipelineCache.coldCreateSeconds);
+
+    VkPipelineCacheCreateInfo cacheInfo = {0};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = dataSize;
+    cacheInfo.pInitialData = data;
+
+    if (vkCreatePipelineCache(device, &cacheInfo, NULL, &pipelineCache.cache) != VK_SUCCESS)
+    {
+        // a blob the driver rejects should not stop the app, start empty instead
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = NULL;
+        free(data);
+        data = NULL;
+
+        if (vkCreatePipelineCache(device, &cacheInfo, NULL, &pipelineCache.cache) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create pipeline cache\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pipelineCache.warm = data != NULL;
+    if (!pipelineCache.warm)
+        pipelineCache.coldCreateSeconds = 0.0;
+
+    free(data);
+    return pipelineCache;
+}
+
+// call with the time pipeline creation took this run, prints what the cache saved
+void reportPipelineCacheTime(PipelineCache *pipelineCache, double createSeconds)
+{
+    if (!pipelineCache->warm)
+    {
+        pipelineCache->coldCreateSeconds = createSeconds;
+        printf("pipeline creation: %.2f ms (cold, cache will be written on exit)\n", createSeconds * 1000.0);
+        return;
+    }
+
+    printf("pipeline creation: %.2f ms with cache, %.2f ms cold, saved %.2f ms\n",
+           createSeconds * 1000.0, pipelineCache->coldCreateSeconds * 1000.0,
+           (pipelineCache->coldCreateSeconds - createSeconds) * 1000.0);
+}
+
+void savePipelineCache(VkDevice device, const PipelineCache *pipelineCache, const char *path)
+{
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache->cache, &dataSize, NULL) != VK_SUCCESS || dataSize == 0)
+        return;
+
+    void *data = malloc(dataSize);
+    if (!data || vkGetPipelineCacheData(device, pipelineCache->cache, &dataSize, data) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to read pipeline cache data\n");
+        free(data);
+        return;
+    }
+
+    PipelineCacheFileHeader header = {0};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.formatVersion = PIPELINE_CACHE_FORMAT_VERSION;
+    header.vendorID = pipelineCache->deviceProperties.vendorID;
+    header.deviceID = pipelineCache->deviceProperties.deviceID;
+    memcpy(header.pipelineCacheUUID, pipelineCache->deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    header.coldCreateSeconds = pipelineCache->coldCreateSeconds;
+
+    // write next to the real file, then swap it in with one rename
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    FILE *file = fopen(tempPath, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", tempPath);
+        free(data);
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(data, 1, dataSize, file) == dataSize;
+    written = fclose(file) == 0 && written;
+    free(data);
+
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write pipeline cache %s\n", tempPath);
+        remove(tempPath);
+        return;
+    }
+
+#ifdef _WIN32
+    remove(path); // rename does not replace an existing file on windows
+#endif
+    if (rename(tempPath, path) != 0)
+    {
+        fprintf(stderr, "Failed to move pipeline cache into place at %s\n", path);
+        remove(tempPath);
+    }
+}
+
+void destroyPipelineCache(VkDevice device, PipelineCache *pipelineCache)
+{
+    vkDestroyPipelineCache(device, pipelineCache->cache, NULL);
+    pipelineCache->cache = VK_NULL_HANDLE;
+}
@@ -0,0 +1,316 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "helpers.c"
+#include "mytrace.c"
+
+// frame profiler: cpu scopes are timed with getTimeSeconds, gpu scopes with vkCmdWriteTimestamp pairs.
+// every frame in flight owns a slice of the query pool, which is read back right after that frame's fence
+// has been waited on (MAX_FRAMES_IN_FLIGHT frames later), so reading results never stalls the cpu.
+// each region keeps a rolling window of samples for min/avg/p95/p99.
+// with tracing enabled cpu scopes also go to the trace, and gpu scopes become ranges on a "gpu" timeline.
+
+#define PROFILER_HISTORY 512          // samples kept per region and timeline
+#define PROFILER_MAX_GPU_SCOPES 16    // timestamp pairs one frame can write
+#define PROFILER_REPORT_INTERVAL 5.0 // seconds between reports while running
+
+typedef enum
+{
+    PROFILE_FRAME,     // cpu: one main loop iteration, gpu: the whole primary command buffer
+    PROFILE_MAIN_PASS, // gpu: the render pass with all draws
+    PROFILE_POLL,
+    PROFILE_TRANSFORM_UPDATE,
+    PROFILE_FENCE_WAIT,
+    PROFILE_ACQUIRE,
+    PROFILE_BUFFER_UPDATE, // ubo and instance slice writes
+    PROFILE_RECORD,
+    PROFILE_SUBMIT,
+    PROFILE_PRESENT,
+    PROFILE_REGION_COUNT
+} ProfileRegion;
+
+static const char *profileRegionNames[PROFILE_REGION_COUNT] = {
+    "frame",
+    "main pass",
+    "poll",
+    "transform update",
+    "fence wait",
+    "acquire",
+    "ubo/instance update",
+    "record",
+    "submit",
+    "present",
+};
+
+typedef struct
+{
+    double samples[PROFILER_HISTORY]; // seconds, ring buffer
+    uint32_t sampleCount;
+    uint32_t nextSample;
+} ProfilerTimeline;
+
+typedef struct
+{
+    uint32_t region;
+    bool ended;
+} GpuScope;
+
+typedef struct
+{
+    TraceRing *ring;      // NULL unless tracing was enabled before the profiler was created
+    double *recordTimes;  // cpu time each frame's commands were recorded, the gpu cannot have started before it
+    double clockOffset;   // gpu seconds minus cpu seconds, the smallest difference seen so far
+    bool calibrated;
+} GpuTrace;
+
+typedef struct
+{
+    VkDevice device;
+    VkQueryPool queryPool; // VK_NULL_HANDLE when the queue cannot write timestamps, only cpu scopes are timed then
+    double timestampPeriod; // nanoseconds per tick
+    uint64_t timestampMask;
+    uint32_t frameCount;
+
+    GpuScope *gpuScopes; // [frame * PROFILER_MAX_GPU_SCOPES + scope]
+    uint32_t *gpuScopeCounts;
+
+    ProfilerTimeline cpu[PROFILE_REGION_COUNT];
+    ProfilerTimeline gpu[PROFILE_REGION_COUNT];
+
+    GpuTrace trace;
+} Profiler;
+
+Profiler *createProfiler(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t frameCount)
+{
+    Profiler *profiler = calloc(1, sizeof(Profiler));
+    if (!profiler)
+    {
+        fprintf(stderr, "Failed to allocate profiler\n");
+        exit(EXIT_FAILURE);
+    }
+
+    profiler->device = device;
+    profiler->frameCount = frameCount;
+    profiler->gpuScopes = calloc(frameCount * PROFILER_MAX_GPU_SCOPES, sizeof(GpuScope));
+    profiler->gpuScopeCounts = calloc(frameCount, sizeof(uint32_t));
+    profiler->trace.recordTimes = calloc(frameCount, sizeof(double));
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+    VkQueueFamilyProperties *queueFamilies = malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies);
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    free(queueFamilies);
+
+    if (validBits == 0 || deviceProperties.limits.timestampPeriod == 0.0f)
+    {
+        printf("profiler: queue family %u has no timestamps, timing cpu scopes only\n", queueFamilyIndex);
+        return profiler;
+    }
+
+    profiler->timestampPeriod = deviceProperties.limits.timestampPeriod;
+    profiler->timestampMask = validBits >= 64 ? UINT64_MAX : ((1ull << validBits) - 1);
+
+    VkQueryPoolCreateInfo queryPoolInfo = {0};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = frameCount * PROFILER_MAX_GPU_SCOPES * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, NULL, &profiler->queryPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create timestamp query pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (isTracing())
+        profiler->trace.ring = createTraceRing("gpu");
+
+    return profiler;
+}
+
+void destroyProfiler(Profiler *profiler)
+{
+    if (profiler->queryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(profiler->device, profiler->queryPool, NULL);
+    free(profiler->gpuScopes);
+    free(profiler->gpuScopeCounts);
+    free(profiler->trace.recordTimes);
+    free(profiler);
+}
+
+static void addProfilerSample(ProfilerTimeline *timeline, double seconds)
+{
+    timeline->samples[timeline->nextSample] = seconds;
+    timeline->nextSample = (timeline->nextSample + 1) % PROFILER_HISTORY;
+    if (timeline->sampleCount < PROFILER_HISTORY)
+        timeline->sampleCount++;
+}
+
+// cpu scopes: double start = beginCpuScope(profiler, PROFILE_X); ... endCpuScope(profiler, PROFILE_X, start);
+// a NULL profiler only traces, and without tracing both are no-ops
+double beginCpuScope(Profiler *profiler, ProfileRegion region)
+{
+    traceBegin(profileRegionNames[region]);
+    return profiler ? getTimeSeconds() : 0.0;
+}
+
+void endCpuScope(Profiler *profiler, ProfileRegion region, double start)
+{
+    if (profiler)
+        addProfilerSample(&profiler->cpu[region], getTimeSeconds() - start);
+    traceEnd(profileRegionNames[region]);
+}
+
+// resets the frame's queries, has to be recorded outside a render pass before any gpu scope of the frame
+void beginGpuFrame(Profiler *profiler, VkCommandBuffer commandBuffer, uint32_t frame)
+{
+    if (!profiler || profiler->queryPool == VK_NULL_HANDLE)
+        return;
+
+    vkCmdResetQueryPool(commandBuffer, profiler->queryPool, frame * PROFILER_MAX_GPU_SCOPES * 2, PROFILER_MAX_GPU_SCOPES * 2);
+    profiler->gpuScopeCounts[frame] = 0;
+    profiler->trace.recordTimes[frame] = getTimeSeconds();
+}
+
+// returns the scope to hand to endGpuScope, UINT32_MAX when nothing was written
+uint32_t beginGpuScope(Profiler *profiler, VkCommandBuffer commandBuffer, uint32_t frame, ProfileRegion region)
+{
+    if (!profiler || profiler->queryPool == VK_NULL_HANDLE || profiler->gpuScopeCounts[frame] == PROFILER_MAX_GPU_SCOPES)
+        return UINT32_MAX;
+
+    uint32_t scope = profiler->gpuScopeCounts[frame]++;
+    profiler->gpuScopes[frame * PROFILER_MAX_GPU_SCOPES + scope] = (GpuScope){region, false};
+
+    uint32_t query = (frame * PROFILER_MAX_GPU_SCOPES + scope) * 2;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, query);
+    return scope;
+}
+
+void endGpuScope(Profiler *profiler, VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+{
+    if (!profiler || scope == UINT32_MAX)
+        return;
+
+    uint32_t query = (frame * PROFILER_MAX_GPU_SCOPES + scope) * 2 + 1;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool, query);
+    profiler->gpuScopes[frame * PROFILER_MAX_GPU_SCOPES + scope].ended = true;
+}
+
+// call right after the frame's fence was waited on: its timestamps are final, read them without waiting
+void collectGpuFrame(Profiler *profiler, uint32_t frame)
+{
+    if (!profiler || profiler->queryPool == VK_NULL_HANDLE || profiler->gpuScopeCounts[frame] == 0)
+        return;
+
+    uint32_t scopeCount = profiler->gpuScopeCounts[frame];
+    uint64_t timestamps[PROFILER_MAX_GPU_SCOPES * 2];
+
+    VkResult result = vkGetQueryPoolResults(profiler->device, profiler->queryPool, frame * PROFILER_MAX_GPU_SCOPES * 2, scopeCount * 2,
+                                            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    profiler->gpuScopeCounts[frame] = 0;
+    if (result != VK_SUCCESS)
+        return; // VK_NOT_READY only happens if the frame was never submitted, drop it
+
+    double secondsPerTick = profiler->timestampPeriod * 1e-9;
+    GpuTrace *trace = &profiler->trace;
+    if (trace->ring)
+    {
+        // without calibrated timestamps the two clocks are lined up by assuming the gpu started the quickest
+        // frame right as it was recorded, every other frame then starts that much later than its recording
+        double offset = (timestamps[0] & profiler->timestampMask) * secondsPerTick - trace->recordTimes[frame];
+        if (!trace->calibrated || offset < trace->clockOffset)
+            trace->clockOffset = offset;
+        trace->calibrated = true;
+    }
+
+    for (uint32_t i = 0; i < scopeCount; i++)
+    {
+        const GpuScope *scope = &profiler->gpuScopes[frame * PROFILER_MAX_GPU_SCOPES + i];
+        if (!scope->ended)
+            continue;
+
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & profiler->timestampMask;
+        addProfilerSample(&profiler->gpu[scope->region], ticks * secondsPerTick);
+
+        if (trace->ring)
+        {
+            double begin = (timestamps[i * 2] & profiler->timestampMask) * secondsPerTick - trace->clockOffset;
+            pushTraceEvent(trace->ring, profileRegionNames[scope->region], begin, ticks * secondsPerTick, 'X');
+        }
+    }
+}
+
+typedef struct
+{
+    double min, avg, p95, p99;
+} ProfilerSummary;
+
+static ProfilerSummary summarizeTimeline(const ProfilerTimeline *timeline)
+{
+    double sorted[PROFILER_HISTORY];
+    memcpy(sorted, timeline->samples, timeline->sampleCount * sizeof(double));
+    qsort(sorted, timeline->sampleCount, sizeof(double), compareDoubles);
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < timeline->sampleCount; i++)
+    {
+        sum += sorted[i];
+    }
+
+    ProfilerSummary summary;
+    summary.min = sorted[0];
+    summary.avg = sum / timeline->sampleCount;
+    summary.p95 = sorted[(uint32_t)(timeline->sampleCount * 0.95)];
+    summary.p99 = sorted[(uint32_t)(timeline->sampleCount * 0.99)];
+    return summary;
+}
+
+// average gpu time of a region over the last PROFILER_HISTORY frames, 0 without a profiler or timestamps
+double getGpuAverageSeconds(const Profiler *profiler, ProfileRegion region)
+{
+    if (!profiler || profiler->gpu[region].sampleCount == 0)
+        return 0.0;
+    return summarizeTimeline(&profiler->gpu[region]).avg;
+}
+
+// min/avg/p95/p99 of the last PROFILER_HISTORY samples of every region, plus which side bounds the frame
+void printProfilerReport(const Profiler *profiler)
+{
+    printf("%-22s %-4s %9s %9s %9s %9s  (ms, last %u samples)\n", "region", "", "min", "avg", "p95", "p99", PROFILER_HISTORY);
+
+    for (uint32_t r = 0; r < PROFILE_REGION_COUNT; r++)
+    {
+        const ProfilerTimeline *timelines[2] = {&profiler->cpu[r], &profiler->gpu[r]};
+        const char *sides[2] = {"cpu", "gpu"};
+
+        for (uint32_t side = 0; side < 2; side++)
+        {
+            if (timelines[side]->sampleCount == 0)
+                continue;
+
+            ProfilerSummary summary = summarizeTimeline(timelines[side]);
+            printf("%-22s %-4s %9.3f %9.3f %9.3f %9.3f\n", profileRegionNames[r], sides[side],
+                   summary.min * 1000.0, summary.avg * 1000.0, summary.p95 * 1000.0, summary.p99 * 1000.0);
+        }
+    }
+
+    // the cpu frame includes the fence wait, so a cpu frame close to the gpu frame means we are waiting on the gpu
+    if (profiler->cpu[PROFILE_FRAME].sampleCount > 0 && profiler->gpu[PROFILE_FRAME].sampleCount > 0)
+    {
+        double cpuFrame = summarizeTimeline(&profiler->cpu[PROFILE_FRAME]).avg;
+        double gpuFrame = summarizeTimeline(&profiler->gpu[PROFILE_FRAME]).avg;
+        double cpuWork = cpuFrame;
+        if (profiler->cpu[PROFILE_FENCE_WAIT].sampleCount > 0)
+            cpuWork -= summarizeTimeline(&profiler->cpu[PROFILE_FENCE_WAIT]).avg;
+
+        printf("cpu work %.3f ms vs gpu %.3f ms per frame: %s bound\n", cpuWork * 1000.0, gpuFrame * 1000.0, gpuFrame > cpuWork ? "gpu" : "cpu");
+    }
+}
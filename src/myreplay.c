@@ -0,0 +1,173 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/structure.h"
+
+// input recording and replay. a recording is a header followed by one event per frame on which the held keys
+// changed: the frame number and a bitmask of the keys held from that frame on. replay feeds those masks back into
+// KeyStates on the same frame numbers and runs the simulation on a fixed timestep, so two builds replaying one
+// file do the same work frame for frame. only keys that change the scene are recorded, not T (trace dump).
+
+#define INPUT_RECORDING_MAGIC 0x52495556u // "VUIR"
+#define INPUT_RECORDING_VERSION 1u
+#define INPUT_REPLAY_DEFAULT_TIMESTEP (1.0 / 60.0)
+
+typedef enum
+{
+    INPUT_KEY_W = 1u << 0,
+    INPUT_KEY_A = 1u << 1,
+    INPUT_KEY_S = 1u << 2,
+    INPUT_KEY_D = 1u << 3,
+    INPUT_KEY_SPACE = 1u << 4,
+    INPUT_KEY_DELETE = 1u << 5,
+    INPUT_KEY_1 = 1u << 6,
+    INPUT_KEY_2 = 1u << 7,
+} InputKey;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frameCount; // frames the recorded session ran, replay stops there
+    uint32_t eventCount;
+    uint32_t reserved;
+} InputRecordingHeader;
+
+typedef struct
+{
+    uint32_t frame;
+    uint32_t keys; // InputKey bits held from this frame on
+} InputEvent;
+
+typedef struct
+{
+    FILE *file; // recording only
+    bool replaying;
+
+    uint32_t keys; // mask of the last recorded or replayed event
+    InputEvent *events; // replay only, the whole file is read up front
+    uint32_t eventCount;
+    uint32_t nextEvent;
+    uint64_t frameCount;
+} InputRecorder;
+
+static uint32_t packKeyStates(const KeyStates *keyStates)
+{
+    return (keyStates->keyWPressed ? INPUT_KEY_W : 0) |
+           (keyStates->keyAPressed ? INPUT_KEY_A : 0) |
+           (keyStates->keySPressed ? INPUT_KEY_S : 0) |
+           (keyStates->keyDPressed ? INPUT_KEY_D : 0) |
+           (keyStates->keySpacePressed ? INPUT_KEY_SPACE : 0) |
+           (keyStates->keyDeletePressed ? INPUT_KEY_DELETE : 0) |
+           (keyStates->key1Pressed ? INPUT_KEY_1 : 0) |
+           (keyStates->key2Pressed ? INPUT_KEY_2 : 0);
+}
+
+static void unpackKeyStates(uint32_t keys, KeyStates *keyStates)
+{
+    keyStates->keyWPressed = (keys & INPUT_KEY_W) != 0;
+    keyStates->keyAPressed = (keys & INPUT_KEY_A) != 0;
+    keyStates->keySPressed = (keys & INPUT_KEY_S) != 0;
+    keyStates->keyDPressed = (keys & INPUT_KEY_D) != 0;
+    keyStates->keySpacePressed = (keys & INPUT_KEY_SPACE) != 0;
+    keyStates->keyDeletePressed = (keys & INPUT_KEY_DELETE) != 0;
+    keyStates->key1Pressed = (keys & INPUT_KEY_1) != 0;
+    keyStates->key2Pressed = (keys & INPUT_KEY_2) != 0;
+}
+
+InputRecorder *createInputRecorder(const char *path)
+{
+    InputRecorder *recorder = calloc(1, sizeof(InputRecorder));
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // frame and event counts are filled in by destroyInputRecorder
+    InputRecordingHeader header = {INPUT_RECORDING_MAGIC, INPUT_RECORDING_VERSION, 0, 0, 0};
+    fwrite(&header, sizeof(header), 1, recorder->file);
+    return recorder;
+}
+
+InputRecorder *loadInputReplay(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open input recording %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    InputRecordingHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != INPUT_RECORDING_MAGIC || header.version != INPUT_RECORDING_VERSION)
+    {
+        fprintf(stderr, "%s is not an input recording of this version\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    InputRecorder *recorder = calloc(1, sizeof(InputRecorder));
+    recorder->replaying = true;
+    recorder->frameCount = header.frameCount;
+    recorder->eventCount = header.eventCount;
+    recorder->events = malloc(sizeof(InputEvent) * (header.eventCount > 0 ? header.eventCount : 1));
+
+    if (fread(recorder->events, sizeof(InputEvent), header.eventCount, file) != header.eventCount)
+    {
+        fprintf(stderr, "Input recording %s is truncated\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+
+    printf("replaying %s: %u input events over %llu frames\n", path, recorder->eventCount, (unsigned long long)recorder->frameCount);
+    return recorder;
+}
+
+// call once per frame after input was polled: recording appends an event when the held keys changed,
+// replay overwrites keyStates with what was held on this frame of the recording
+void processInputFrame(InputRecorder *recorder, uint64_t frameNumber, KeyStates *keyStates)
+{
+    if (!recorder)
+        return;
+
+    if (recorder->replaying)
+    {
+        while (recorder->nextEvent < recorder->eventCount && recorder->events[recorder->nextEvent].frame <= frameNumber)
+        {
+            recorder->keys = recorder->events[recorder->nextEvent++].keys;
+        }
+        unpackKeyStates(recorder->keys, keyStates);
+        return;
+    }
+
+    uint32_t keys = packKeyStates(keyStates);
+    if (keys != recorder->keys)
+    {
+        InputEvent event = {(uint32_t)frameNumber, keys};
+        fwrite(&event, sizeof(event), 1, recorder->file);
+        recorder->keys = keys;
+        recorder->eventCount++;
+    }
+    recorder->frameCount = frameNumber + 1;
+}
+
+void destroyInputRecorder(InputRecorder *recorder)
+{
+    if (recorder->file)
+    {
+        InputRecordingHeader header = {INPUT_RECORDING_MAGIC, INPUT_RECORDING_VERSION, recorder->frameCount, recorder->eventCount, 0};
+        bool written = fseek(recorder->file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, recorder->file) == 1;
+        written = fclose(recorder->file) == 0 && written;
+        if (!written)
+            fprintf(stderr, "Failed to finish the input recording\n");
+        else
+            printf("recorded %u input events over %llu frames\n", recorder->eventCount, (unsigned long long)recorder->frameCount);
+    }
+
+    free(recorder->events);
+    free(recorder);
+}
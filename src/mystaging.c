@@ -0,0 +1,391 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mymemory.c"
+
+// staging ring: one persistently mapped host visible buffer that every upload (meshes now, textures/instances later)
+// memcpy's into, plus a small set of fenced command buffers that copy from it into device local buffers.
+// space is handed out front to back and only reused once the batch that read it has signalled its fence.
+// a ring belongs to one thread. rings on a transfer only queue hand buffers to the graphics queue family with
+// stagingRingReleaseBuffer, the graphics ring takes them over with stagingRingAcquireBuffer.
+
+#define STAGING_RING_DEFAULT_SIZE (16ull * 1024 * 1024)
+#define STAGING_RING_MAX_BATCHES 8
+
+typedef struct
+{
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkDeviceSize endOffset; // ring head when the batch was submitted, tail moves here once the fence signals
+    VkDeviceSize bytes;     // ring bytes the batch holds on to (including alignment/wrap padding)
+} StagingBatch;
+
+typedef struct
+{
+    GpuAllocator *allocator;
+    VkQueue queue;
+    uint32_t queueFamilyIndex;
+    bool graphicsQueue; // false on a transfer only queue, whose barriers can not name vertex or shader stages
+    VkCommandPool commandPool;
+
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    char *mapped;
+    VkDeviceSize size;
+
+    VkDeviceSize head;      // next free byte
+    VkDeviceSize tail;      // oldest byte still owned by an in flight batch
+    VkDeviceSize usedBytes; // bytes between tail and head (wrap padding included)
+
+    StagingBatch batches[STAGING_RING_MAX_BATCHES];
+    uint32_t firstPendingBatch; // oldest submitted batch
+    uint32_t pendingBatchCount; // submitted batches not yet retired
+    bool recording;             // batches[(first + pending) % MAX] is open and has commands in it
+    VkDeviceSize openBytes;     // ring bytes taken by the open batch
+
+    VkDeviceSize uploadedBytes; // total bytes copied through the ring, for stats
+} StagingRing;
+
+StagingRing *createStagingRing(GpuAllocator *allocator, uint32_t queueFamilyIndex, VkQueue queue, VkDeviceSize size)
+{
+    StagingRing *ring = calloc(1, sizeof(StagingRing));
+    if (!ring)
+    {
+        fprintf(stderr, "Failed to allocate memory for the staging ring\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDevice device = allocator->device;
+    ring->allocator = allocator;
+    ring->queue = queue;
+    ring->queueFamilyIndex = queueFamilyIndex;
+    ring->size = size;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(allocator->physicalDevice, &queueFamilyCount, NULL);
+    VkQueueFamilyProperties *queueFamilies = malloc(sizeof(VkQueueFamilyProperties) * (queueFamilyCount > 0 ? queueFamilyCount : 1));
+    vkGetPhysicalDeviceQueueFamilyProperties(allocator->physicalDevice, &queueFamilyCount, queueFamilies);
+    ring->graphicsQueue = queueFamilyIndex < queueFamilyCount && (queueFamilies[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+    free(queueFamilies);
+
+    VkBufferCreateInfo bufferInfo = {0};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, NULL, &ring->buffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create staging buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, ring->buffer, &memRequirements);
+
+    // the allocator keeps host visible memory mapped, non coherent memory is flushed when the copy is recorded
+    gpuAllocate(allocator, memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &ring->allocation);
+    vkBindBufferMemory(device, ring->buffer, ring->allocation.memory, ring->allocation.offset);
+    ring->mapped = ring->allocation.mapped;
+
+    VkCommandPoolCreateInfo poolInfo = {0};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    if (vkCreateCommandPool(device, &poolInfo, NULL, &ring->commandPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create staging command pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkCommandBuffer commandBuffers[STAGING_RING_MAX_BATCHES];
+    VkCommandBufferAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = ring->commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = STAGING_RING_MAX_BATCHES;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate staging command buffers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkFenceCreateInfo fenceInfo = {0};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < STAGING_RING_MAX_BATCHES; i++)
+    {
+        ring->batches[i].commandBuffer = commandBuffers[i];
+        if (vkCreateFence(device, &fenceInfo, NULL, &ring->batches[i].fence) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create staging fence\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return ring;
+}
+
+static void retireStagingBatch(StagingRing *ring)
+{
+    StagingBatch *batch = &ring->batches[ring->firstPendingBatch];
+
+    vkResetFences(ring->allocator->device, 1, &batch->fence);
+    ring->tail = batch->endOffset;
+    ring->usedBytes -= batch->bytes;
+
+    ring->firstPendingBatch = (ring->firstPendingBatch + 1) % STAGING_RING_MAX_BATCHES;
+    ring->pendingBatchCount--;
+}
+
+// releases the space of every batch the gpu is done with, never blocks
+void stagingRingCollect(StagingRing *ring)
+{
+    while (ring->pendingBatchCount > 0)
+    {
+        StagingBatch *batch = &ring->batches[ring->firstPendingBatch];
+        if (vkGetFenceStatus(ring->allocator->device, batch->fence) != VK_SUCCESS)
+            break;
+        retireStagingBatch(ring);
+    }
+}
+
+static void waitOldestStagingBatch(StagingRing *ring)
+{
+    StagingBatch *batch = &ring->batches[ring->firstPendingBatch];
+    vkWaitForFences(ring->allocator->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+    retireStagingBatch(ring);
+}
+
+static StagingBatch *getOpenStagingBatch(StagingRing *ring)
+{
+    if (!ring->recording)
+    {
+        if (ring->pendingBatchCount == STAGING_RING_MAX_BATCHES)
+            waitOldestStagingBatch(ring);
+
+        StagingBatch *batch = &ring->batches[(ring->firstPendingBatch + ring->pendingBatchCount) % STAGING_RING_MAX_BATCHES];
+        vkResetCommandBuffer(batch->commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo = {0};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (vkBeginCommandBuffer(batch->commandBuffer, &beginInfo) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to begin staging command buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        ring->recording = true;
+    }
+    return &ring->batches[(ring->firstPendingBatch + ring->pendingBatchCount) % STAGING_RING_MAX_BATCHES];
+}
+
+// closes the open batch (if any) and hands it to the queue, the fence tells us when its ring space is free again
+void stagingRingSubmit(StagingRing *ring)
+{
+    if (!ring->recording)
+        return;
+
+    StagingBatch *batch = getOpenStagingBatch(ring);
+
+    // make the copies visible to whatever reads the destination buffers in later submissions. a transfer queue
+    // runs no draws, its buffers reach the graphics queue through release/acquire barriers instead
+    if (ring->graphicsQueue)
+    {
+        VkMemoryBarrier barrier = {0};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+
+    if (vkEndCommandBuffer(batch->commandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to end staging command buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkSubmitInfo submitInfo = {0};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->commandBuffer;
+
+    if (vkQueueSubmit(ring->queue, 1, &submitInfo, batch->fence) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit staging command buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    batch->endOffset = ring->head;
+    batch->bytes = ring->openBytes;
+    ring->openBytes = 0;
+    ring->pendingBatchCount++;
+    ring->recording = false;
+}
+
+// returns a mapped pointer to size bytes of ring space, blocks on old batches when the ring is full.
+// record the copy for a reservation before reserving again, a full ring submits whatever is recorded so far
+void *stagingRingReserve(StagingRing *ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *outOffset)
+{
+    if (size > ring->size)
+    {
+        fprintf(stderr, "Staging reservation of %llu bytes is bigger than the ring (%llu bytes)\n", (unsigned long long)size, (unsigned long long)ring->size);
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;)
+    {
+        if (ring->usedBytes == 0)
+            ring->head = ring->tail = 0; // empty ring, start over at the front
+
+        VkDeviceSize offset = alignDeviceSize(ring->head, alignment);
+        VkDeviceSize padding = offset - ring->head;
+
+        if (ring->head >= ring->tail)
+        {
+            // free space is [head, size) followed by [0, tail)
+            if (offset + size <= ring->size)
+            {
+                ring->head = offset + size;
+                ring->usedBytes += padding + size;
+                ring->openBytes += padding + size;
+                *outOffset = offset;
+                return ring->mapped + offset;
+            }
+            if (size < ring->tail)
+            {
+                VkDeviceSize wrapPadding = ring->size - ring->head;
+                ring->head = size;
+                ring->usedBytes += wrapPadding + size;
+                ring->openBytes += wrapPadding + size;
+                *outOffset = 0;
+                return ring->mapped;
+            }
+        }
+        else if (offset + size < ring->tail)
+        {
+            ring->head = offset + size;
+            ring->usedBytes += padding + size;
+            ring->openBytes += padding + size;
+            *outOffset = offset;
+            return ring->mapped + offset;
+        }
+
+        // out of space: push what we recorded so far and wait for the oldest batch to give its bytes back
+        stagingRingSubmit(ring);
+        if (ring->pendingBatchCount == 0)
+        {
+            fprintf(stderr, "Staging ring is full with nothing in flight\n");
+            exit(EXIT_FAILURE);
+        }
+        waitOldestStagingBatch(ring);
+    }
+}
+
+// records a copy out of previously reserved ring space into dstBuffer
+void stagingRingCopyToBuffer(StagingRing *ring, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size)
+{
+    StagingBatch *batch = getOpenStagingBatch(ring);
+
+    gpuFlushAllocation(ring->allocator, &ring->allocation, srcOffset, size);
+
+    VkBufferCopy copyRegion = {0};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(batch->commandBuffer, ring->buffer, dstBuffer, 1, &copyRegion);
+
+    ring->uploadedBytes += size;
+}
+
+// copies data into the ring and records the transfer, uploads bigger than half the ring are split into chunks
+void stagingRingUploadBuffer(StagingRing *ring, VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    VkDeviceSize maxChunk = ring->size / 2;
+    const char *src = data;
+
+    while (size > 0)
+    {
+        VkDeviceSize chunk = size < maxChunk ? size : maxChunk;
+        VkDeviceSize srcOffset;
+        void *dst = stagingRingReserve(ring, chunk, 16, &srcOffset);
+        memcpy(dst, src, chunk);
+        stagingRingCopyToBuffer(ring, srcOffset, dstBuffer, dstOffset, chunk);
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+}
+
+// queue family ownership transfer of a whole buffer this ring copied into, from this ring's family to dstQueueFamilyIndex.
+// recorded into the open batch, the matching stagingRingAcquireBuffer has to be submitted after this batch completed
+void stagingRingReleaseBuffer(StagingRing *ring, VkBuffer buffer, uint32_t dstQueueFamilyIndex)
+{
+    if (dstQueueFamilyIndex == ring->queueFamilyIndex)
+        return;
+
+    StagingBatch *batch = getOpenStagingBatch(ring);
+
+    VkBufferMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = ring->queueFamilyIndex;
+    barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+    barrier.buffer = buffer;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+// the other half of stagingRingReleaseBuffer, on the ring of the queue family that draws with the buffer.
+// the open batch goes out ahead of the frame's draws, like every upload
+void stagingRingAcquireBuffer(StagingRing *ring, VkBuffer buffer, uint32_t srcQueueFamilyIndex)
+{
+    if (srcQueueFamilyIndex == ring->queueFamilyIndex)
+        return;
+
+    StagingBatch *batch = getOpenStagingBatch(ring);
+
+    VkBufferMemoryBarrier barrier = {0};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+    barrier.dstQueueFamilyIndex = ring->queueFamilyIndex;
+    barrier.buffer = buffer;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+// submits and waits for everything, only meant for shutdown/teardown paths and the asset loader thread
+void stagingRingFlush(StagingRing *ring)
+{
+    stagingRingSubmit(ring);
+    while (ring->pendingBatchCount > 0)
+        waitOldestStagingBatch(ring);
+}
+
+void destroyStagingRing(StagingRing *ring)
+{
+    VkDevice device = ring->allocator->device;
+
+    stagingRingFlush(ring);
+
+    for (uint32_t i = 0; i < STAGING_RING_MAX_BATCHES; i++)
+        vkDestroyFence(device, ring->batches[i].fence, NULL);
+    vkDestroyCommandPool(device, ring->commandPool, NULL);
+
+    vkDestroyBuffer(device, ring->buffer, NULL);
+    gpuFree(ring->allocator, &ring->allocation);
+
+    free(ring);
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "helpers.c"
+
+// frame time statistics over a rolling window of the last FRAME_STATS_WINDOW frames. frame times land in a
+// histogram of FRAME_STATS_BUCKET_SECONDS wide buckets, so percentiles cost one walk over the buckets instead
+// of a sort, and a frame leaving the window is just one bucket decrement. hitches are frames over a threshold,
+// counted over the whole run. with a csv path every frame is also written out as one row.
+
+#define FRAME_STATS_WINDOW 1024
+#define FRAME_STATS_BUCKET_SECONDS 0.0001 // 0.1 ms
+#define FRAME_STATS_BUCKET_COUNT 1000     // up to 100 ms, slower frames go to the last bucket
+#define FRAME_STATS_DEFAULT_HITCH_MS 33.3
+
+typedef struct
+{
+    double frameTimes[FRAME_STATS_WINDOW]; // ring of the frames in the window, seconds
+    uint32_t frameCount;                   // frames in the window
+    uint32_t nextFrame;
+    uint32_t buckets[FRAME_STATS_BUCKET_COUNT];
+
+    double hitchThreshold; // seconds
+    uint64_t hitchCount;
+    uint64_t reportedHitches; // hitchCount at the last report
+    uint64_t totalFrames;
+
+    FILE *csv; // NULL without --csv
+} FrameStats;
+
+static uint32_t frameStatsBucket(double seconds)
+{
+    double bucket = seconds / FRAME_STATS_BUCKET_SECONDS;
+    if (bucket < 0.0)
+        return 0;
+    if (bucket >= FRAME_STATS_BUCKET_COUNT - 1)
+        return FRAME_STATS_BUCKET_COUNT - 1;
+    return (uint32_t)bucket;
+}
+
+FrameStats *createFrameStats(double hitchThresholdMs, const char *csvPath)
+{
+    FrameStats *stats = calloc(1, sizeof(FrameStats));
+    if (!stats)
+    {
+        fprintf(stderr, "Failed to allocate frame statistics\n");
+        exit(EXIT_FAILURE);
+    }
+
+    stats->hitchThreshold = (hitchThresholdMs > 0.0 ? hitchThresholdMs : FRAME_STATS_DEFAULT_HITCH_MS) / 1000.0;
+
+    if (csvPath)
+    {
+        stats->csv = fopen(csvPath, "w");
+        if (!stats->csv)
+        {
+            fprintf(stderr, "Failed to open %s for writing\n", csvPath);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stats->csv, "frame,frame_ms,instances,draws,bytes_uploaded\n");
+    }
+
+    return stats;
+}
+
+void destroyFrameStats(FrameStats *stats)
+{
+    if (stats->csv)
+        fclose(stats->csv);
+    free(stats);
+}
+
+// bytesUploaded: what the cpu wrote for the gpu this frame (uniforms, instances, staging uploads)
+void recordFrameStats(FrameStats *stats, double frameSeconds, uint32_t instanceCount, uint32_t drawCount, uint64_t bytesUploaded)
+{
+    if (stats->frameCount == FRAME_STATS_WINDOW)
+        stats->buckets[frameStatsBucket(stats->frameTimes[stats->nextFrame])]--;
+    else
+        stats->frameCount++;
+
+    stats->frameTimes[stats->nextFrame] = frameSeconds;
+    stats->nextFrame = (stats->nextFrame + 1) % FRAME_STATS_WINDOW;
+    stats->buckets[frameStatsBucket(frameSeconds)]++;
+
+    if (frameSeconds > stats->hitchThreshold)
+        stats->hitchCount++;
+
+    if (stats->csv)
+        fprintf(stats->csv, "%llu,%.4f,%u,%u,%llu\n", (unsigned long long)stats->totalFrames, frameSeconds * 1000.0,
+                instanceCount, drawCount, (unsigned long long)bytesUploaded);
+
+    stats->totalFrames++;
+}
+
+// upper edge of the bucket holding the given fraction of the window, 0.5 -> p50
+double frameStatsPercentile(const FrameStats *stats, double fraction)
+{
+    if (stats->frameCount == 0)
+        return 0.0;
+
+    uint32_t rank = (uint32_t)(fraction * (stats->frameCount - 1)) + 1;
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < FRAME_STATS_BUCKET_COUNT; i++)
+    {
+        seen += stats->buckets[i];
+        if (seen >= rank)
+            return (i + 1) * FRAME_STATS_BUCKET_SECONDS;
+    }
+    return FRAME_STATS_BUCKET_COUNT * FRAME_STATS_BUCKET_SECONDS;
+}
+
+double frameStatsMax(const FrameStats *stats)
+{
+    double max = 0.0;
+    for (uint32_t i = 0; i < stats->frameCount; i++)
+    {
+        if (stats->frameTimes[i] > max)
+            max = stats->frameTimes[i];
+    }
+    return max;
+}
+
+// one line per call, hitches are counted since the previous report and over the whole run
+void printFrameStats(FrameStats *stats)
+{
+    if (stats->frameCount == 0)
+        return;
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < stats->frameCount; i++)
+    {
+        sum += stats->frameTimes[i];
+    }
+
+    printf("frame ms (last %u): p50 %.1f, p90 %.1f, p99 %.1f, max %.2f, %.1f frames/sec, %llu hitches > %.1f ms (%llu total)\n",
+           stats->frameCount,
+           frameStatsPercentile(stats, 0.50) * 1000.0,
+           frameStatsPercentile(stats, 0.90) * 1000.0,
+           frameStatsPercentile(stats, 0.99) * 1000.0,
+           frameStatsMax(stats) * 1000.0,
+           stats->frameCount / sum,
+           (unsigned long long)(stats->hitchCount - stats->reportedHitches),
+           stats->hitchThreshold * 1000.0,
+           (unsigned long long)stats->hitchCount);
+
+    stats->reportedHitches = stats->hitchCount;
+    if (stats->csv)
+        fflush(stats->csv);
+}
+
+// one json object on one line, the benchmark driver (tests/benchmark.c) reads these back. gpu_pass_ms is the average
+// gpu time of the render pass, only measured with --profile (0 without)
+void writeRunResults(const char *path, const FrameTimeSummary *summary, double loadSeconds, uint64_t loadPeakRssBytes, uint32_t instanceCount, uint32_t drawCount, uint64_t hitchCount,
+                     uint64_t vertexBytes, double gpuPassSeconds)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"frames\":%u,\"load_ms\":%.3f,\"load_peak_rss_mb\":%.1f,\"avg_ms\":%.4f,\"p50_ms\":%.4f,\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f,"
+                  "\"instances\":%u,\"draws\":%u,\"hitches\":%llu,\"vertex_mb\":%.3f,\"gpu_pass_ms\":%.4f}\n",
+            summary->frameCount, loadSeconds * 1000.0, loadPeakRssBytes / (1024.0 * 1024.0), summary->avg * 1000.0, summary->p50 * 1000.0, summary->p95 * 1000.0,
+            summary->p99 * 1000.0, summary->max * 1000.0, instanceCount, drawCount, (unsigned long long)hitchCount,
+            vertexBytes / (1024.0 * 1024.0), gpuPassSeconds * 1000.0);
+    fclose(file);
+}
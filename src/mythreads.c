@@ -0,0 +1,168 @@
+#pragma once
+#include <pthread.h>
+#include <unistd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// small fork/join thread pool: threadPoolRun hands out taskCount tasks to the workers (and the calling thread)
+// and returns once every task has finished. workers sleep on a condition variable between runs.
+
+typedef void (*ThreadPoolTask)(void *userData, uint32_t taskIndex);
+
+typedef struct
+{
+    pthread_t *threads;
+    uint32_t workerCount; // threads owned by the pool, the thread calling threadPoolRun works too
+
+    pthread_mutex_t mutex;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+
+    ThreadPoolTask task;
+    void *userData;
+    uint32_t taskCount;
+    uint32_t nextTask;     // next task index to hand out
+    uint32_t pendingTasks; // handed out or not, tasks of this run that have not finished yet
+    bool shuttingDown;
+} ThreadPool;
+
+uint32_t getProcessorCount()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return (uint32_t)count;
+#endif
+    return 1;
+}
+
+// takes the next task of the current run, the pool mutex has to be held
+static bool takeThreadPoolTask(ThreadPool *pool, uint32_t *taskIndex)
+{
+    if (pool->nextTask >= pool->taskCount)
+        return false;
+
+    *taskIndex = pool->nextTask++;
+    return true;
+}
+
+static void finishThreadPoolTask(ThreadPool *pool)
+{
+    pool->pendingTasks--;
+    if (pool->pendingTasks == 0)
+        pthread_cond_signal(&pool->workDone);
+}
+
+static void *threadPoolWorker(void *argument)
+{
+    ThreadPool *pool = argument;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        uint32_t taskIndex;
+        while (!pool->shuttingDown && !takeThreadPoolTask(pool, &taskIndex))
+            pthread_cond_wait(&pool->workReady, &pool->mutex);
+
+        if (pool->shuttingDown)
+            break;
+
+        ThreadPoolTask task = pool->task;
+        void *userData = pool->userData;
+
+        pthread_mutex_unlock(&pool->mutex);
+        task(userData, taskIndex);
+        pthread_mutex_lock(&pool->mutex);
+
+        finishThreadPoolTask(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+ThreadPool *createThreadPool(uint32_t workerCount)
+{
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool)
+    {
+        fprintf(stderr, "Failed to allocate thread pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+
+    pool->workerCount = workerCount;
+    pool->threads = malloc(sizeof(pthread_t) * (workerCount > 0 ? workerCount : 1));
+
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, threadPoolWorker, pool) != 0)
+        {
+            fprintf(stderr, "Failed to create thread pool worker %u\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+// runs task(userData, 0..taskCount-1) spread across the pool, blocks until all of them returned
+void threadPoolRun(ThreadPool *pool, uint32_t taskCount, ThreadPoolTask task, void *userData)
+{
+    if (taskCount == 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->userData = userData;
+    pool->taskCount = taskCount;
+    pool->nextTask = 0;
+    pool->pendingTasks = taskCount;
+    if (pool->workerCount > 0 && taskCount > 1)
+        pthread_cond_broadcast(&pool->workReady);
+
+    // the calling thread takes tasks as well instead of sitting idle
+    uint32_t taskIndex;
+    while (takeThreadPoolTask(pool, &taskIndex))
+    {
+        pthread_mutex_unlock(&pool->mutex);
+        task(userData, taskIndex);
+        pthread_mutex_lock(&pool->mutex);
+
+        finishThreadPoolTask(pool);
+    }
+
+    while (pool->pendingTasks > 0)
+        pthread_cond_wait(&pool->workDone, &pool->mutex);
+
+    pool->task = NULL;
+    pool->userData = NULL;
+    pool->taskCount = 0;
+    pool->nextTask = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void destroyThreadPool(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->shuttingDown = true;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->workerCount; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->workDone);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
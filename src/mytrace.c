@@ -0,0 +1,194 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "helpers.c"
+
+// event tracing for chrome://tracing / ui.perfetto.dev. every thread writes begin/end events into its own ring,
+// so recording an event is a few plain stores and one release store of the ring head, no locks, no shared cache lines.
+// rings keep the last TRACE_RING_CAPACITY events, writeTrace dumps whatever is still in them as json.
+// writeTrace reads other threads' rings without stopping them: call it from the main loop between frames,
+// while the recording workers sit idle in the thread pool, otherwise events being overwritten may come out torn.
+
+#define TRACE_RING_CAPACITY 65536 // events per thread, a power of two
+#define TRACE_MAX_RINGS 64        // threads (plus the gpu timeline) that can record
+#define TRACE_NAME_LENGTH 32
+
+typedef struct
+{
+    const char *name; // has to outlive the trace, string literals or the region name table
+    double timestamp; // seconds on the getTimeSeconds clock
+    double duration;  // 'X' events only
+    char phase;       // 'B' begin, 'E' end, 'X' complete (gpu ranges)
+} TraceEvent;
+
+typedef struct
+{
+    TraceEvent *events;
+    _Atomic uint64_t head; // events ever written, only the owning thread stores it
+    uint32_t id;           // tid in the json
+    char name[TRACE_NAME_LENGTH];
+} TraceRing;
+
+static _Atomic(TraceRing *) traceRings[TRACE_MAX_RINGS];
+static _Atomic uint32_t traceRingCount;
+static atomic_bool traceEnabled;
+static double traceStartTime;
+static _Thread_local TraceRing *threadTraceRing;
+
+// ring for a timeline that is not a thread (the gpu), or for the calling thread through traceThreadRing.
+// returns NULL once TRACE_MAX_RINGS are in use, events of that timeline are dropped then
+TraceRing *createTraceRing(const char *name)
+{
+    uint32_t index = atomic_fetch_add(&traceRingCount, 1);
+    if (index >= TRACE_MAX_RINGS)
+        return NULL;
+
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    ring->events = malloc(sizeof(TraceEvent) * TRACE_RING_CAPACITY);
+    if (!ring->events)
+    {
+        fprintf(stderr, "Failed to allocate trace ring\n");
+        exit(EXIT_FAILURE);
+    }
+    ring->id = index + 1;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+
+    atomic_store(&traceRings[index], ring);
+    return ring;
+}
+
+static TraceRing *traceThreadRing()
+{
+    if (!threadTraceRing)
+    {
+        char name[TRACE_NAME_LENGTH];
+        snprintf(name, sizeof(name), "thread %u", atomic_load(&traceRingCount));
+        threadTraceRing = createTraceRing(name);
+    }
+    return threadTraceRing;
+}
+
+void enableTracing()
+{
+    traceStartTime = getTimeSeconds();
+    threadTraceRing = createTraceRing("main"); // the first thread to enable tracing is the main loop
+    atomic_store(&traceEnabled, true);
+}
+
+static inline bool isTracing()
+{
+    return atomic_load_explicit(&traceEnabled, memory_order_relaxed);
+}
+
+void pushTraceEvent(TraceRing *ring, const char *name, double timestamp, double duration, char phase)
+{
+    if (!ring)
+        return;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head & (TRACE_RING_CAPACITY - 1)] = (TraceEvent){name, timestamp, duration, phase};
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// traceBegin("name"); ... traceEnd("name"); on any thread, nesting is fine. no-ops unless tracing is enabled
+void traceBegin(const char *name)
+{
+    if (isTracing())
+        pushTraceEvent(traceThreadRing(), name, getTimeSeconds(), 0.0, 'B');
+}
+
+void traceEnd(const char *name)
+{
+    if (isTracing())
+        pushTraceEvent(traceThreadRing(), name, getTimeSeconds(), 0.0, 'E');
+}
+
+static void writeTraceEvent(FILE *file, bool *first, const TraceRing *ring, const TraceEvent *event)
+{
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f", *first ? "" : ",",
+            event->name, event->phase, ring->id, (event->timestamp - traceStartTime) * 1e6);
+    if (event->phase == 'X')
+        fprintf(file, ",\"dur\":%.3f", event->duration * 1e6);
+    fprintf(file, "}");
+    *first = false;
+}
+
+// dumps every ring to path in the chrome trace event format
+void writeTrace(const char *path)
+{
+    if (!isTracing())
+        return;
+
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    uint64_t eventCount = 0;
+
+    uint32_t ringCount = atomic_load(&traceRingCount);
+    if (ringCount > TRACE_MAX_RINGS)
+        ringCount = TRACE_MAX_RINGS;
+
+    for (uint32_t r = 0; r < ringCount; r++)
+    {
+        const TraceRing *ring = atomic_load(&traceRings[r]);
+        if (!ring)
+            continue; // registered but not published yet
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", ring->id, ring->name);
+        first = false;
+
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t begin = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+
+        // a wrapped ring can start in the middle of a scope, drop ends whose begin was overwritten
+        uint32_t depth = 0;
+        for (uint64_t i = begin; i < head; i++)
+        {
+            const TraceEvent *event = &ring->events[i & (TRACE_RING_CAPACITY - 1)];
+            if (event->phase == 'E')
+            {
+                if (depth == 0)
+                    continue;
+                depth--;
+            }
+            else if (event->phase == 'B')
+                depth++;
+
+            writeTraceEvent(file, &first, ring, event);
+            eventCount++;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("trace: wrote %llu events to %s\n", (unsigned long long)eventCount, path);
+}
+
+// call once the thread pool is destroyed, no worker may still hold its ring
+void destroyTracing()
+{
+    atomic_store(&traceEnabled, false);
+
+    uint32_t ringCount = atomic_load(&traceRingCount);
+    for (uint32_t r = 0; r < ringCount && r < TRACE_MAX_RINGS; r++)
+    {
+        TraceRing *ring = atomic_exchange(&traceRings[r], NULL);
+        if (!ring)
+            continue;
+        free(ring->events);
+        free(ring);
+    }
+    atomic_store(&traceRingCount, 0);
+    threadTraceRing = NULL;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// the interleaved vertex every mesh is stored in, 24 bytes instead of the 48 of plain floats:
+//   inPosition  3 x float32                                   12 bytes
+//   inNormal    octahedral direction, 2 x snorm16              4 bytes
+//   inTangent   octahedral direction, 2 x snorm16              4 bytes, the bitangent sign is folded into y
+//   inUv        2 x float16 (uvs may tile past 0..1)           4 bytes
+// the gltf loader, the cooker and the cube all pack through the functions below, getVertexFormat (myvulkan.c) turns
+// the layout into vertex input descriptions and shaders/vertex_shader.glsl unpacks it
+
+typedef struct
+{
+    float inPosition[3];
+    int16_t inNormal[2];
+    int16_t inTangent[2];
+    uint16_t inUv[2];
+} Vertex;
+
+static int16_t packSnorm16(float value)
+{
+    value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+    return (int16_t)lroundf(value * 32767.0f);
+}
+
+// unit vector onto the octahedron, folded into [-1, 1]^2. a zero vector comes out as +z
+static void encodeOctahedral(const float direction[3], float encoded[2])
+{
+    float length = fabsf(direction[0]) + fabsf(direction[1]) + fabsf(direction[2]);
+    float x = length > 0.0f ? direction[0] / length : 0.0f;
+    float y = length > 0.0f ? direction[1] / length : 0.0f;
+    if (direction[2] < 0.0f)
+    {
+        float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = x;
+    encoded[1] = y;
+}
+
+void packNormal(const float normal[3], int16_t packed[2])
+{
+    float encoded[2];
+    encodeOctahedral(normal, encoded);
+    packed[0] = packSnorm16(encoded[0]);
+    packed[1] = packSnorm16(encoded[1]);
+}
+
+// xyz is the direction, w (+1 or -1) the bitangent sign. y is remapped to [0, 1] and takes the sign of w, at least one
+// step away from 0 so a negative sign survives. costs y one bit of precision
+void packTangent(const float tangent[4], int16_t packed[2])
+{
+    float encoded[2];
+    encodeOctahedral(tangent, encoded);
+    float y = encoded[1] * 0.5f + 0.5f;
+    y = y > 1.0f / 32767.0f ? y : 1.0f / 32767.0f;
+    packed[0] = packSnorm16(encoded[0]);
+    packed[1] = packSnorm16(tangent[3] < 0.0f ? -y : y);
+}
+
+// ieee half, rounded to nearest even. out of range values become infinity, tiny ones half subnormals or zero
+uint16_t packHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t mantissa = bits & 0x7fffffu;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xffu) - 127 + 15;
+
+    if (((bits >> 23) & 0xffu) == 0xffu)
+        return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u : 0u)); // infinity, nan stays a (quiet) nan
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7c00u);
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (uint16_t)sign;
+        mantissa |= 0x800000u; // the implicit one, the result is a subnormal
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u)))
+            half++;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+        half++; // a carry out of the mantissa bumps the exponent, up to infinity, which is the right rounding
+    return (uint16_t)(sign | half);
+}
+
+// what a mesh gets for attributes its source does not have: +z normal, +x tangent with a positive sign, uv 0
+void packVertexDefaults(Vertex *vertex)
+{
+    static const float normal[3] = {0.0f, 0.0f, 1.0f};
+    static const float tangent[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+    packNormal(normal, vertex->inNormal);
+    packTangent(tangent, vertex->inTangent);
+    vertex->inUv[0] = 0;
+    vertex->inUv[1] = 0;
+}
+
+// --quantize-positions: the same vertex with the position as 3 x unorm16 (plus one unused lane, 4 component 16-bit
+// formats are the ones every device can fetch) inside the bounding box of the whole mesh, 20 bytes instead of 24.
+// the box comes from the gltf accessors' min/max, the shader gets it back through the UBO
+typedef struct
+{
+    uint16_t inPosition[4];
+    int16_t inNormal[2];
+    int16_t inTangent[2];
+    uint16_t inUv[2];
+} QuantizedVertex;
+
+// position = offset + scale * unorm position, scale 1 and offset 0 for float positions
+typedef struct
+{
+    float offset[3];
+    float scale[3];
+} PositionQuantization;
+
+PositionQuantization makePositionQuantization(const float boundsMin[3], const float boundsMax[3])
+{
+    PositionQuantization quantization;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        quantization.offset[axis] = boundsMin[axis];
+        quantization.scale[axis] = boundsMax[axis] > boundsMin[axis] ? boundsMax[axis] - boundsMin[axis] : 0.0f;
+    }
+    return quantization;
+}
+
+PositionQuantization identityPositionQuantization()
+{
+    PositionQuantization quantization = {{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}};
+    return quantization;
+}
+
+// positions outside the box are clamped onto it
+void quantizeVertex(const Vertex *vertex, const PositionQuantization *quantization, QuantizedVertex *quantized)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float scale = quantization->scale[axis];
+        float value = scale > 0.0f ? (vertex->inPosition[axis] - quantization->offset[axis]) / scale : 0.0f;
+        value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+        quantized->inPosition[axis] = (uint16_t)lroundf(value * 65535.0f);
+    }
+    quantized->inPosition[3] = 0;
+    memcpy(quantized->inNormal, vertex->inNormal, sizeof(quantized->inNormal));
+    memcpy(quantized->inTangent, vertex->inTangent, sizeof(quantized->inTangent));
+    memcpy(quantized->inUv, vertex->inUv, sizeof(quantized->inUv));
+}
@@ -6,6 +6,21 @@
 
 #include "../include/structure.h"
 #include "helpers.c"
+#include "mymemory.c"
+#include "mystaging.c"
+#include "mycommands.c"
+#include "mypipelinecache.c"
+#include "myheadless.c"
+
+// everything one frame in flight owns, indexed by currentFrame (never by the swap chain image index)
+typedef struct
+{
+    VkCommandBuffer commandBuffer;
+    VkDescriptorSet descriptorSet; // points at this frame's UBO slice
+    uint32_t slice;                // slice of every FrameSlicedBuffer this frame writes (uniforms, instances)
+    VkSemaphore imageAvailableSemaphore;
+    VkFence inFlightFence; // signalled when the gpu is done with everything above
+} FrameContext;
 
 VkInstance createVulkanInstance()
 {
@@ -250,28 +265,79 @@ int findGraphicsQueueFamilyIndex(VkPhysicalDevice physicalDevice)
     return graphicsQueueFamilyIndex;
 }
 
-VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, uint32_t graphicsQueueFamilyIndex, VkQueue *graphicsQueue, VkQueue *presentQueue)
+// a queue for background uploads next to the graphics queue: a transfer only family (the dma engine on discrete
+// gpus), else a second queue of the graphics family. UINT32_MAX when the device only has the one graphics queue
+uint32_t findTransferQueueFamilyIndex(VkPhysicalDevice physicalDevice, uint32_t graphicsQueueFamilyIndex)
+{
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+
+    VkQueueFamilyProperties *queueFamilies = malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies);
+
+    uint32_t transferQueueFamilyIndex = UINT32_MAX;
+    for (uint32_t i = 0; i < queueFamilyCount; i++)
+    {
+        if ((queueFamilies[i].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            queueFamilies[i].queueCount > 0)
+        {
+            transferQueueFamilyIndex = i;
+            break;
+        }
+    }
+
+    if (transferQueueFamilyIndex == UINT32_MAX && queueFamilies[graphicsQueueFamilyIndex].queueCount >= 2)
+        transferQueueFamilyIndex = graphicsQueueFamilyIndex;
+
+    free(queueFamilies);
+    return transferQueueFamilyIndex;
+}
+
+// multi draw indirect with firstInstance, what one vkCmdDrawIndexedIndirect over the whole draw list needs
+bool supportsIndirectDraws(VkPhysicalDevice physicalDevice)
+{
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    return supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+}
+
+// transferQueueFamilyIndex comes from findTransferQueueFamilyIndex, transferQueue is left VK_NULL_HANDLE for UINT32_MAX
+VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, uint32_t graphicsQueueFamilyIndex, uint32_t transferQueueFamilyIndex, bool enableSwapchain,
+                             VkQueue *graphicsQueue, VkQueue *presentQueue, VkQueue *transferQueue)
 {
-    float queuePriority = 1.0f;
-    VkDeviceQueueCreateInfo queueCreateInfo = {0};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIndex;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    float queuePriorities[2] = {1.0f, 0.5f}; // uploads yield to rendering when they share a family
+    VkDeviceQueueCreateInfo queueCreateInfos[2] = {0};
+    uint32_t queueCreateInfoCount = 1;
+    queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfos[0].queueFamilyIndex = graphicsQueueFamilyIndex;
+    queueCreateInfos[0].queueCount = transferQueueFamilyIndex == graphicsQueueFamilyIndex ? 2 : 1;
+    queueCreateInfos[0].pQueuePriorities = queuePriorities;
+    if (transferQueueFamilyIndex != UINT32_MAX && transferQueueFamilyIndex != graphicsQueueFamilyIndex)
+    {
+        queueCreateInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfos[1].queueFamilyIndex = transferQueueFamilyIndex;
+        queueCreateInfos[1].queueCount = 1;
+        queueCreateInfos[1].pQueuePriorities = &queuePriorities[1];
+        queueCreateInfoCount = 2;
+    }
 
     VkPhysicalDeviceFeatures deviceFeatures = {0};
     // Set any physical device features you'll be using here
+    bool indirectDraws = supportsIndirectDraws(physicalDevice);
+    deviceFeatures.multiDrawIndirect = indirectDraws;
+    deviceFeatures.drawIndirectFirstInstance = indirectDraws;
 
     VkDeviceCreateInfo createInfo = {0};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    createInfo.pQueueCreateInfos = &queueCreateInfo;
-    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = queueCreateInfos;
+    createInfo.queueCreateInfoCount = queueCreateInfoCount;
     createInfo.pEnabledFeatures = &deviceFeatures;
 
     // If you're using specific device extensions (like for swap chains), list them here
     // const char *deviceExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME, "VK_KHR_portability_subset"};
     const char *deviceExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME}; // for windows
-    createInfo.enabledExtensionCount = sizeof(deviceExtensions) / sizeof(deviceExtensions[0]);
+    createInfo.enabledExtensionCount = enableSwapchain ? sizeof(deviceExtensions) / sizeof(deviceExtensions[0]) : 0; // headless runs have nothing to present to
     createInfo.ppEnabledExtensionNames = deviceExtensions;
 
     VkDevice device;
@@ -285,10 +351,16 @@ VkDevice createLogicalDevice(VkPhysicalDevice physicalDevice, uint32_t graphicsQ
     vkGetDeviceQueue(device, graphicsQueueFamilyIndex, 0, graphicsQueue);
     vkGetDeviceQueue(device, graphicsQueueFamilyIndex, 0, presentQueue);
 
+    *transferQueue = VK_NULL_HANDLE;
+    if (transferQueueFamilyIndex != UINT32_MAX)
+        vkGetDeviceQueue(device, transferQueueFamilyIndex, transferQueueFamilyIndex == graphicsQueueFamilyIndex ? 1 : 0, transferQueue);
+
     return device;
 }
 
-VkSwapchainKHR createSwapChain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, VkExtent2D *swapChainExtent)
+// oldSwapChain lets the driver hand resources over from the retired swap chain, pass VK_NULL_HANDLE the first time.
+// fallbackExtent (the framebuffer size) is used when the surface leaves the extent up to us
+VkSwapchainKHR createSwapChain(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, VkSwapchainKHR oldSwapChain, VkExtent2D fallbackExtent, VkExtent2D *swapChainExtent)
 {
     // Query Surface Capabilities
     VkSurfaceCapabilitiesKHR surfaceCapabilities;
@@ -329,12 +401,23 @@ VkSwapchainKHR createSwapChain(VkPhysicalDevice physicalDevice, VkDevice device,
 
     // Determine Swap Extent
     *swapChainExtent = surfaceCapabilities.currentExtent;
+    if (surfaceCapabilities.currentExtent.width == UINT32_MAX)
+    {
+        VkExtent2D minExtent = surfaceCapabilities.minImageExtent;
+        VkExtent2D maxExtent = surfaceCapabilities.maxImageExtent;
+        swapChainExtent->width = fallbackExtent.width < minExtent.width ? minExtent.width : (fallbackExtent.width > maxExtent.width ? maxExtent.width : fallbackExtent.width);
+        swapChainExtent->height = fallbackExtent.height < minExtent.height ? minExtent.height : (fallbackExtent.height > maxExtent.height ? maxExtent.height : fallbackExtent.height);
+    }
+
+    uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
+    if (surfaceCapabilities.maxImageCount > 0 && imageCount > surfaceCapabilities.maxImageCount)
+        imageCount = surfaceCapabilities.maxImageCount;
 
     // Create the Swap Chain
     VkSwapchainCreateInfoKHR swapChainCreateInfo = {0};
     swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
     swapChainCreateInfo.surface = surface;
-    swapChainCreateInfo.minImageCount = surfaceCapabilities.minImageCount + 1;
+    swapChainCreateInfo.minImageCount = imageCount;
     swapChainCreateInfo.imageFormat = chosenFormat.format;
     swapChainCreateInfo.imageColorSpace = chosenFormat.colorSpace;
     swapChainCreateInfo.imageExtent = *swapChainExtent;
@@ -345,7 +428,7 @@ VkSwapchainKHR createSwapChain(VkPhysicalDevice physicalDevice, VkDevice device,
     swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapChainCreateInfo.presentMode = chosenPresentMode;
     swapChainCreateInfo.clipped = VK_TRUE;
-    swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+    swapChainCreateInfo.oldSwapchain = oldSwapChain;
 
     VkSwapchainKHR swapChain;
     if (vkCreateSwapchainKHR(device, &swapChainCreateInfo, NULL, &swapChain) != VK_SUCCESS)
@@ -422,7 +505,8 @@ VkImageView *createImageViews(VkDevice device, VkSwapchainKHR swapChain, VkForma
     return swapChainImageViews;
 }
 
-VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat)
+// finalLayout is VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for the swap chain, offscreen targets keep the image as a transfer source
+VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat, VkImageLayout finalLayout)
 {
     VkAttachmentDescription colorAttachment = {0};
     colorAttachment.format = swapChainImageFormat;
@@ -432,7 +516,7 @@ VkRenderPass createRenderPass(VkDevice device, VkFormat swapChainImageFormat)
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = finalLayout;
 
     VkAttachmentReference colorAttachmentRef = {0};
     colorAttachmentRef.attachment = 0;
@@ -522,7 +606,48 @@ VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout *de
     return pipelineLayout;
 }
 
-VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const char *vertShaderCode, size_t vertShaderSize, const char *fragShaderCode, size_t fragShaderSize)
+#define VERTEX_FORMAT_MAX_ATTRIBUTES 8
+
+typedef struct
+{
+    uint32_t location; // layout(location = n) in shaders/vertex_shader.glsl
+    VkFormat format;
+    uint32_t offset;
+} VertexAttribute;
+
+// how one vertex of binding 0 is laid out, createGraphicsPipeline builds its vertex input descriptions from it
+typedef struct
+{
+    uint32_t stride;
+    uint32_t attributeCount;
+    VertexAttribute attributes[VERTEX_FORMAT_MAX_ATTRIBUTES];
+} VertexFormat;
+
+// the packed Vertex of myvertex.c, or its QuantizedVertex. locations 1 to 4 are taken by the rows of the instance
+// matrix (binding 1)
+VertexFormat getVertexFormat(bool quantizedPositions)
+{
+    VertexFormat format = {0};
+    if (quantizedPositions)
+    {
+        format.stride = sizeof(QuantizedVertex);
+        format.attributes[format.attributeCount++] = (VertexAttribute){0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(QuantizedVertex, inPosition)};
+        format.attributes[format.attributeCount++] = (VertexAttribute){5, VK_FORMAT_R16G16_SNORM, offsetof(QuantizedVertex, inNormal)};
+        format.attributes[format.attributeCount++] = (VertexAttribute){6, VK_FORMAT_R16G16_SNORM, offsetof(QuantizedVertex, inTangent)};
+        format.attributes[format.attributeCount++] = (VertexAttribute){7, VK_FORMAT_R16G16_SFLOAT, offsetof(QuantizedVertex, inUv)};
+        return format;
+    }
+
+    format.stride = sizeof(Vertex);
+    format.attributes[format.attributeCount++] = (VertexAttribute){0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, inPosition)};
+    format.attributes[format.attributeCount++] = (VertexAttribute){5, VK_FORMAT_R16G16_SNORM, offsetof(Vertex, inNormal)};
+    format.attributes[format.attributeCount++] = (VertexAttribute){6, VK_FORMAT_R16G16_SNORM, offsetof(Vertex, inTangent)};
+    format.attributes[format.attributeCount++] = (VertexAttribute){7, VK_FORMAT_R16G16_SFLOAT, offsetof(Vertex, inUv)};
+    return format;
+}
+
+VkPipeline createGraphicsPipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const VertexFormat *vertexFormat,
+                                  const char *vertShaderCode, size_t vertShaderSize, const char *fragShaderCode, size_t fragShaderSize)
 {
     // Create shader modules
     VkShaderModule vertexShaderModule = createShaderModule(device, vertShaderCode, vertShaderSize);
@@ -547,7 +672,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     // description
     VkVertexInputBindingDescription bindingDescription = {0};
     bindingDescription.binding = 0;             // The binding index (used in the vertex buffer)
-    bindingDescription.stride = sizeof(Vertex); // Size of a single vertex object
+    bindingDescription.stride = vertexFormat->stride; // Size of a single vertex object
     bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     VkVertexInputBindingDescription instanceBindingDescription = {0};
@@ -555,36 +680,35 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     instanceBindingDescription.stride = sizeof(InstanceData);
     instanceBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-    // attributes
-    VkVertexInputAttributeDescription attributeDescriptions[2] = {0};
-    attributeDescriptions[0].binding = 0;                           // Matches the binding in the bindingDescription
-    attributeDescriptions[0].location = 0;                          // Location in the shader (layout(location = 0))
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;   // Format for vec3 (3 floats)
-    attributeDescriptions[0].offset = offsetof(Vertex, inPosition); // Offset of 'inPosition' within the Vertex struct
+    // attributes: the vertex format's on binding 0, then the instance matrix rows on binding 1
+    VkVertexInputAttributeDescription attributes[VERTEX_FORMAT_MAX_ATTRIBUTES + 4] = {0};
+    uint32_t attributeCount = 0;
+    for (uint32_t i = 0; i < vertexFormat->attributeCount; i++)
+    {
+        attributes[attributeCount].binding = 0; // Matches the binding in the bindingDescription
+        attributes[attributeCount].location = vertexFormat->attributes[i].location;
+        attributes[attributeCount].format = vertexFormat->attributes[i].format;
+        attributes[attributeCount].offset = vertexFormat->attributes[i].offset;
+        attributeCount++;
+    }
 
-    VkVertexInputAttributeDescription instanceAttributeDescriptions[4];
     for (int i = 0; i < 4; ++i)
     {
-        instanceAttributeDescriptions[i].binding = 1;      // Assuming instance data is at binding index 1
-        instanceAttributeDescriptions[i].location = 1 + i; // Locations 1, 2, 3, 4
-        instanceAttributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        instanceAttributeDescriptions[i].offset = sizeof(float) * 4 * i;
+        attributes[attributeCount].binding = 1;      // Assuming instance data is at binding index 1
+        attributes[attributeCount].location = 1 + i; // Locations 1, 2, 3, 4
+        attributes[attributeCount].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributes[attributeCount].offset = sizeof(float) * 4 * i;
+        attributeCount++;
     }
 
+    VkVertexInputBindingDescription bindings[] = {bindingDescription, instanceBindingDescription};
+
     // vertex binding
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {0};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = 1;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
-
-    VkVertexInputBindingDescription bindings[] = {bindingDescription, instanceBindingDescription};
-    VkVertexInputAttributeDescription attributes[] = {attributeDescriptions[0], instanceAttributeDescriptions[0], instanceAttributeDescriptions[1], instanceAttributeDescriptions[2], instanceAttributeDescriptions[3]};
-
     vertexInputInfo.vertexBindingDescriptionCount = 2; // Two bindings: one for vertex, one for instance
     vertexInputInfo.pVertexBindingDescriptions = bindings;
-    vertexInputInfo.vertexAttributeDescriptionCount = 5; // Total number of attribute descriptions
+    vertexInputInfo.vertexAttributeDescriptionCount = attributeCount;
     vertexInputInfo.pVertexAttributeDescriptions = attributes;
 
     // Input Assembly
@@ -593,26 +717,19 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    // Viewports and Scissors
-    VkViewport viewport = {0};
-    VkRect2D scissor = {0};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapChainExtent.width;
-    viewport.height = (float)swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    scissor.extent = swapChainExtent;
-
+    // Viewports and Scissors are dynamic, set while recording, so a resize never rebuilds the pipeline
     VkPipelineViewportStateCreateInfo viewportState = {0};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = NULL;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = NULL;
+
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState = {0};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     // Rasterizer
     VkPipelineRasterizationStateCreateInfo rasterizer = {0};
@@ -659,6 +776,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = pipelineLayout; // Assumes a pipelineLayout variable is defined
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
@@ -671,7 +789,7 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     pipelineInfo.layout = pipelineLayout;
 
     VkPipeline graphicsPipeline;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &graphicsPipeline) != VK_SUCCESS)
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, NULL, &graphicsPipeline) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to create graphics pipeline\n");
         exit(EXIT_FAILURE);
@@ -684,63 +802,86 @@ VkPipeline createGraphicsPipeline(VkDevice device, VkExtent2D swapChainExtent, V
     return graphicsPipeline;
 }
 
-void createUniformBuffers(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t bufferCount, VkBuffer *uniformBuffers, VkDeviceMemory *uniformBufferMemory)
+// createFrameSlicedBuffer and createMeshBuffers depend on createBuffer
+void createBuffer(GpuAllocator *allocator, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, GpuAllocation *allocation)
 {
-    VkDeviceSize bufferSize = sizeof(UBO); // Assuming UBO is your Uniform Buffer Object structure
+    VkBufferCreateInfo bufferInfo = {0};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    for (uint32_t i = 0; i < bufferCount; ++i)
+    if (vkCreateBuffer(allocator->device, &bufferInfo, NULL, buffer) != VK_SUCCESS)
     {
-        // Create the buffer
-        VkBufferCreateInfo bufferInfo = {0};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = bufferSize;
-        bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        if (vkCreateBuffer(device, &bufferInfo, NULL, &uniformBuffers[i]) != VK_SUCCESS)
-        {
-            fprintf(stderr, "Failed to create uniform buffer\n");
-            exit(EXIT_FAILURE);
-        }
+        fprintf(stderr, "Failed to create buffer\n");
+        exit(EXIT_FAILURE);
+    }
 
-        // Allocate memory for the buffer
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, uniformBuffers[i], &memRequirements);
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(allocator->device, *buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo = {0};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    // sub-allocated from a shared block, see mymemory.c
+    gpuAllocate(allocator, memRequirements, properties, allocation);
 
-        if (vkAllocateMemory(device, &allocInfo, NULL, &uniformBufferMemory[i]) != VK_SUCCESS)
-        {
-            fprintf(stderr, "Failed to allocate uniform buffer memory\n");
-            exit(EXIT_FAILURE);
-        }
+    vkBindBufferMemory(allocator->device, *buffer, allocation->memory, allocation->offset);
+}
 
-        vkBindBufferMemory(device, uniformBuffers[i], uniformBufferMemory[i], 0);
-    }
+void destroyBuffer(GpuAllocator *allocator, VkBuffer buffer, GpuAllocation *allocation)
+{
+    vkDestroyBuffer(allocator->device, buffer, NULL);
+    gpuFree(allocator, allocation);
+}
+
+// host visible buffer cut into equally sized slices (one per frame), the cpu only writes a slice the gpu is not reading
+void createFrameSlicedBuffer(GpuAllocator *allocator, VkDeviceSize sliceSize, uint32_t sliceCount, VkDeviceSize sliceAlignment, VkBufferUsageFlags usage, FrameSlicedBuffer *slicedBuffer)
+{
+    slicedBuffer->sliceSize = alignDeviceSize(sliceSize, sliceAlignment);
+    slicedBuffer->sliceCount = sliceCount;
+
+    createBuffer(allocator, slicedBuffer->sliceSize * sliceCount, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &slicedBuffer->buffer, &slicedBuffer->allocation);
 }
 
-void updateUniformBuffer(VkDevice device, VkDeviceMemory uniformBufferMemory, double time, mat4 view, mat4 projection)
+void destroyFrameSlicedBuffer(GpuAllocator *allocator, FrameSlicedBuffer *slicedBuffer)
+{
+    destroyBuffer(allocator, slicedBuffer->buffer, &slicedBuffer->allocation);
+    slicedBuffer->buffer = VK_NULL_HANDLE;
+}
+
+VkDeviceSize getFrameSliceOffset(const FrameSlicedBuffer *slicedBuffer, uint32_t slice)
+{
+    return slicedBuffer->sliceSize * slice;
+}
+
+void writeFrameSlice(GpuAllocator *allocator, const FrameSlicedBuffer *slicedBuffer, uint32_t slice, const void *data, VkDeviceSize size)
+{
+    copyDataToDeviceMemory(allocator, &slicedBuffer->allocation, getFrameSliceOffset(slicedBuffer, slice), data, size);
+}
+
+void createUniformBuffers(GpuAllocator *allocator, uint32_t bufferCount, FrameSlicedBuffer *uniformBuffer)
+{
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(allocator->physicalDevice, &deviceProperties);
+
+    // one UBO slice per frame, descriptor sets point at their slice with an offset
+    createFrameSlicedBuffer(allocator, sizeof(UBO), bufferCount, deviceProperties.limits.minUniformBufferOffsetAlignment, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, uniformBuffer);
+}
+
+void updateUniformBuffer(GpuAllocator *allocator, const FrameSlicedBuffer *uniformBuffer, uint32_t slice, double time, mat4 view, mat4 projection,
+                         const PositionQuantization *positionQuantization)
 {
     UBO ubo;
     ubo.time = time;
     glm_mat4_copy(view, ubo.view);             // Copy the view matrix
     glm_mat4_copy(projection, ubo.projection); // Copy the projection matrix
+    glm_vec4_copy((vec4){positionQuantization->offset[0], positionQuantization->offset[1], positionQuantization->offset[2], 0.0f}, ubo.positionOffset);
+    glm_vec4_copy((vec4){positionQuantization->scale[0], positionQuantization->scale[1], positionQuantization->scale[2], 0.0f}, ubo.positionScale);
 
-    void *data;
-    vkMapMemory(device, uniformBufferMemory, 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(device, uniformBufferMemory);
+    writeFrameSlice(allocator, uniformBuffer, slice, &ubo, sizeof(ubo));
 }
 
-void updateInstanceBuffer(VkDevice device, VkDeviceMemory instanceBufferMemory, InstanceData *instanceData, uint32_t instanceCount)
+void updateInstanceBuffer(GpuAllocator *allocator, const FrameSlicedBuffer *instanceBuffer, uint32_t slice, InstanceData *instanceData, uint32_t instanceCount)
 {
-    void *data;
-    vkMapMemory(device, instanceBufferMemory, 0, sizeof(InstanceData) * instanceCount, 0, &data);
-    memcpy(data, instanceData, sizeof(InstanceData) * instanceCount);
-    vkUnmapMemory(device, instanceBufferMemory);
+    writeFrameSlice(allocator, instanceBuffer, slice, instanceData, sizeof(InstanceData) * instanceCount);
 }
 VkFramebuffer *createFramebuffers(VkDevice device, VkImageView *swapChainImageViews, uint32_t swapChainImageCount, VkExtent2D swapChainExtent, VkRenderPass renderPass)
 {
@@ -805,62 +946,7 @@ VkCommandBuffer *allocateCommandBuffers(VkDevice device, VkCommandPool commandPo
     return commandBuffers;
 }
 
-void recordCommandBuffers(VkCommandBuffer *commandBuffers, uint32_t imageIndex, VkRenderPass renderPass, VkExtent2D swapChainExtent, VkFramebuffer *swapChainFramebuffers, VkPipeline graphicsPipeline, VkBuffer vertexBuffer, VkBuffer indexBuffer, VkBuffer instanceBuffer, uint32_t indexCount, uint32_t instanceCount, VkDescriptorSet *descriptorSets, VkPipelineLayout pipelineLayout)
-{
-    vkResetCommandBuffer(commandBuffers[imageIndex], 0);
-
-    VkCommandBufferBeginInfo beginInfo = {0};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    beginInfo.pInheritanceInfo = NULL;
-
-    if (vkBeginCommandBuffer(commandBuffers[imageIndex], &beginInfo) != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to begin recording command buffer at index %u\n", imageIndex);
-        exit(EXIT_FAILURE);
-    }
-
-    // Begin render pass
-    VkRenderPassBeginInfo renderPassInfo = {0};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
-    renderPassInfo.renderArea.offset = (VkOffset2D){0, 0};
-    renderPassInfo.renderArea.extent = swapChainExtent;
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
-    vkCmdBeginRenderPass(commandBuffers[imageIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-    // Bind the pipeline
-    vkCmdBindPipeline(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-    // Bind the vertex and instance buffers and their offsets
-    VkBuffer vertexBuffers[] = {vertexBuffer, instanceBuffer};
-    VkDeviceSize offsets[] = {0, 0};
-    vkCmdBindVertexBuffers(commandBuffers[imageIndex], 0, 2, vertexBuffers, offsets);
-
-    // Bind the index buffer
-    vkCmdBindIndexBuffer(commandBuffers[imageIndex], indexBuffer, 0, VK_INDEX_TYPE_UINT16); // Assuming uint16_t indices
-
-    // Bind descriptor set
-    vkCmdBindDescriptorSets(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex], 0, NULL);
-
-    // Issue the indexed draw call
-    vkCmdDrawIndexed(commandBuffers[imageIndex], indexCount, instanceCount, 0, 0, 0);
-
-    // End the render pass
-    vkCmdEndRenderPass(commandBuffers[imageIndex]);
-
-    // End the command buffer
-    if (vkEndCommandBuffer(commandBuffers[imageIndex]) != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to end recording command buffer at index %u\n", imageIndex);
-        exit(EXIT_FAILURE);
-    }
-}
-
-VkDescriptorSet *createDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, VkBuffer *uniformBuffers, uint32_t descriptorSetCount)
+VkDescriptorSet *createDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, const FrameSlicedBuffer *uniformBuffer, uint32_t descriptorSetCount)
 {
     VkDescriptorSet *descriptorSets = malloc(descriptorSetCount * sizeof(VkDescriptorSet));
 
@@ -889,8 +975,8 @@ VkDescriptorSet *createDescriptorSets(VkDevice device, VkDescriptorPool descript
     for (uint32_t i = 0; i < descriptorSetCount; ++i)
     {
         VkDescriptorBufferInfo bufferInfo = {0};
-        bufferInfo.buffer = uniformBuffers[i];
-        bufferInfo.offset = 0;
+        bufferInfo.buffer = uniformBuffer->buffer;
+        bufferInfo.offset = getFrameSliceOffset(uniformBuffer, i);
         bufferInfo.range = sizeof(UBO);
 
         VkWriteDescriptorSet descriptorWrite = {0};
@@ -955,67 +1041,165 @@ VkDescriptorPool createDescriptorPool(VkDevice device, uint32_t numDescriptorSet
     return descriptorPool;
 }
 
-// createVertexBuffer and createIndexBuffer buffer functions depend on createBuffer
-void createBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+void createInstanceBuffer(GpuAllocator *allocator, InstanceData *instanceData, uint32_t instanceCount, uint32_t instanceCapacity, uint32_t sliceCount, FrameSlicedBuffer *instanceBuffer)
 {
-    VkBufferCreateInfo bufferInfo = {0};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Create the buffer, every frame in flight gets its own copy of the instance data (sized for capacity, not count)
+    createFrameSlicedBuffer(allocator, sizeof(InstanceData) * instanceCapacity, sliceCount, sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, instanceBuffer);
 
-    if (vkCreateBuffer(device, &bufferInfo, NULL, buffer) != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to create buffer\n");
-        exit(EXIT_FAILURE);
-    }
-
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
+    for (uint32_t i = 0; i < sliceCount; i++)
+        writeFrameSlice(allocator, instanceBuffer, i, instanceData, sizeof(InstanceData) * instanceCount);
+}
 
-    VkMemoryAllocateInfo allocInfo = {0};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
+// static geometry of one model: its vertices, one index buffer with the 16-bit indices in front and the 32-bit
+// indices behind them, and the draw range of every primitive
+typedef struct
+{
+    VkBuffer vertexBuffer;
+    GpuAllocation vertexBufferAllocation;
+    VkBuffer indexBuffer;
+    GpuAllocation indexBufferAllocation;
+    VkDeviceSize indexOffsets[2]; // where the 16-bit and the 32-bit section start
+    DrawRange *ranges;
+    uint32_t rangeCount;
+    uint32_t vertexCount;
+    uint32_t indexCount; // both sections
+    uint32_t vertexStride; // sizeof(Vertex), or sizeof(QuantizedVertex) for quantized positions
+    PositionQuantization positionQuantization; // goes into the UBO while the mesh is drawn
+} Mesh;
+
+// device local vertex and index buffers sized for a mesh, without contents or draw ranges. for loaders that upload
+// straight out of the source data (mygltf.c), createMesh below does it all from arrays. the position quantization
+// starts out as identity, quantizing loaders set it
+void createMeshBuffers(GpuAllocator *allocator, bool quantizedPositions, uint32_t vertexCount, uint32_t indexCount16, uint32_t indexCount32, Mesh *mesh)
+{
+    *mesh = (Mesh){0};
+    mesh->vertexStride = quantizedPositions ? sizeof(QuantizedVertex) : sizeof(Vertex);
+    mesh->positionQuantization = identityPositionQuantization();
+    VkDeviceSize vertexBufferSize = (VkDeviceSize)mesh->vertexStride * vertexCount;
+    createBuffer(allocator, vertexBufferSize > 0 ? vertexBufferSize : mesh->vertexStride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->vertexBuffer, &mesh->vertexBufferAllocation);
+
+    // the 32-bit section has to start 4 byte aligned for vkCmdBindIndexBuffer
+    VkDeviceSize size16 = sizeof(uint16_t) * indexCount16;
+    mesh->indexOffsets[0] = 0;
+    mesh->indexOffsets[1] = (size16 + 3) & ~(VkDeviceSize)3;
+    VkDeviceSize indexBufferSize = mesh->indexOffsets[1] + sizeof(uint32_t) * indexCount32;
+
+    createBuffer(allocator, indexBufferSize > 0 ? indexBufferSize : 4, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->indexBuffer, &mesh->indexBufferAllocation);
+
+    mesh->vertexCount = vertexCount;
+    mesh->indexCount = indexCount16 + indexCount32;
+}
 
-    if (vkAllocateMemory(device, &allocInfo, NULL, bufferMemory) != VK_SUCCESS)
+// quantizes vertices straight into ring space and copies them to the start of dstBuffer, in chunks like
+// stagingRingUploadBuffer
+void uploadQuantizedVertices(StagingRing *stagingRing, VkBuffer dstBuffer, const Vertex *vertices, uint64_t vertexCount,
+                             const PositionQuantization *quantization)
+{
+    uint64_t maxChunk = stagingRing->size / 2 / sizeof(QuantizedVertex);
+    for (uint64_t first = 0; first < vertexCount; first += maxChunk)
     {
-        fprintf(stderr, "Failed to allocate buffer memory\n");
-        exit(EXIT_FAILURE);
+        uint64_t count = vertexCount - first < maxChunk ? vertexCount - first : maxChunk;
+        VkDeviceSize srcOffset;
+        QuantizedVertex *quantized = stagingRingReserve(stagingRing, sizeof(QuantizedVertex) * count, 16, &srcOffset);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            quantizeVertex(&vertices[first + i], quantization, &quantized[i]);
+        }
+        stagingRingCopyToBuffer(stagingRing, srcOffset, dstBuffer, sizeof(QuantizedVertex) * first, sizeof(QuantizedVertex) * count);
     }
-
-    vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
 }
 
-
-void createInstanceBuffer(VkDevice device, VkPhysicalDevice physicalDevice, InstanceData *instanceData, uint32_t instanceCount, VkBuffer *instanceBuffer, VkDeviceMemory *instanceBufferMemory)
+// copies ranges, either index array may be empty. quantizedPositions quantizes into the bounds of the vertices
+void createMesh(GpuAllocator *allocator, StagingRing *stagingRing, bool quantizedPositions, const Vertex *vertices, uint32_t vertexCount,
+                const uint16_t *indices16, uint32_t indexCount16, const uint32_t *indices32, uint32_t indexCount32,
+                const DrawRange *ranges, uint32_t rangeCount, Mesh *mesh)
 {
-    VkDeviceSize bufferSize = sizeof(InstanceData) * instanceCount;
+    createMeshBuffers(allocator, quantizedPositions, vertexCount, indexCount16, indexCount32, mesh);
 
-    // Create the buffer
-    createBuffer(device, physicalDevice, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, instanceBuffer, instanceBufferMemory);
+    if (quantizedPositions)
+    {
+        float boundsMin[3] = {0.0f, 0.0f, 0.0f}, boundsMax[3] = {0.0f, 0.0f, 0.0f};
+        for (uint32_t i = 0; i < vertexCount; i++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float value = vertices[i].inPosition[axis];
+                boundsMin[axis] = i == 0 || value < boundsMin[axis] ? value : boundsMin[axis];
+                boundsMax[axis] = i == 0 || value > boundsMax[axis] ? value : boundsMax[axis];
+            }
+        }
+        mesh->positionQuantization = makePositionQuantization(boundsMin, boundsMax);
 
-    // Map the buffer and copy the instance data into it
-    void *data;
-    vkMapMemory(device, *instanceBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, instanceData, (size_t)bufferSize);
-    vkUnmapMemory(device, *instanceBufferMemory);
+        uploadQuantizedVertices(stagingRing, mesh->vertexBuffer, vertices, vertexCount, &mesh->positionQuantization);
+    }
+    else
+        stagingRingUploadBuffer(stagingRing, mesh->vertexBuffer, 0, vertices, sizeof(Vertex) * vertexCount);
+    if (indexCount16 > 0)
+        stagingRingUploadBuffer(stagingRing, mesh->indexBuffer, mesh->indexOffsets[0], indices16, sizeof(uint16_t) * indexCount16);
+    if (indexCount32 > 0)
+        stagingRingUploadBuffer(stagingRing, mesh->indexBuffer, mesh->indexOffsets[1], indices32, sizeof(uint32_t) * indexCount32);
+
+    mesh->ranges = malloc(sizeof(DrawRange) * (rangeCount > 0 ? rangeCount : 1));
+    memcpy(mesh->ranges, ranges, sizeof(DrawRange) * rangeCount);
+    mesh->rangeCount = rangeCount;
 }
 
-void createVertexBuffer(VkDevice device, VkPhysicalDevice physicalDevice, const Vertex *vertices, uint32_t vertexCount, VkBuffer *vertexBuffer, VkDeviceMemory *vertexBufferMemory) {
-    VkDeviceSize vertexBufferSize = sizeof(Vertex) * vertexCount;
+void destroyMesh(GpuAllocator *allocator, Mesh *mesh)
+{
+    destroyBuffer(allocator, mesh->vertexBuffer, &mesh->vertexBufferAllocation);
+    destroyBuffer(allocator, mesh->indexBuffer, &mesh->indexBufferAllocation);
+    free(mesh->ranges);
+    *mesh = (Mesh){0};
+}
 
-    createBuffer(device, physicalDevice, vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer, vertexBufferMemory);
+// the draw list in gpu memory for vkCmdDrawIndexedIndirect, one slice per frame in flight.
+// a slice is only rewritten when the draw list changed since that slice was last written
+typedef struct
+{
+    FrameSlicedBuffer buffer;
+    uint32_t capacity;       // draws per slice
+    uint64_t *sliceVersions; // draw list version in each slice, 0 is never a valid version
+} IndirectDrawBuffer;
 
-    copyDataToDeviceMemory(device, *vertexBufferMemory, vertices, vertexBufferSize);
+void createIndirectDrawBuffer(GpuAllocator *allocator, uint32_t capacity, uint32_t sliceCount, IndirectDrawBuffer *indirectBuffer)
+{
+    *indirectBuffer = (IndirectDrawBuffer){0};
+    indirectBuffer->capacity = capacity > 0 ? capacity : 1;
+    indirectBuffer->sliceVersions = calloc(sliceCount, sizeof(uint64_t));
+    createFrameSlicedBuffer(allocator, sizeof(VkDrawIndexedIndirectCommand) * indirectBuffer->capacity, sliceCount,
+                            sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &indirectBuffer->buffer);
 }
 
-void createIndexBuffer(VkDevice device, VkPhysicalDevice physicalDevice, const uint16_t *indices, uint32_t indexCount, VkBuffer *indexBuffer, VkDeviceMemory *indexBufferMemory) {
-    VkDeviceSize indexBufferSize = sizeof(uint16_t) * indexCount;
+void destroyIndirectDrawBuffer(GpuAllocator *allocator, IndirectDrawBuffer *indirectBuffer)
+{
+    destroyFrameSlicedBuffer(allocator, &indirectBuffer->buffer);
+    free(indirectBuffer->sliceVersions);
+    *indirectBuffer = (IndirectDrawBuffer){0};
+}
 
-    createBuffer(device, physicalDevice, indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexBuffer, indexBufferMemory);
+// returns the bytes written, 0 when the slice already held this version of the draw list.
+// grows like addInstance: the old buffer is retired through the deletion queue and every slice gets rewritten
+uint64_t updateIndirectDrawBuffer(GpuAllocator *allocator, DeletionQueue *deletionQueue, uint64_t frameNumber, IndirectDrawBuffer *indirectBuffer, uint32_t slice, const DrawList *drawList)
+{
+    if (drawList->drawCount > indirectBuffer->capacity)
+    {
+        uint32_t capacity = indirectBuffer->capacity;
+        uint32_t sliceCount = indirectBuffer->buffer.sliceCount;
+        while (capacity < drawList->drawCount)
+            capacity *= 2;
+
+        deferBufferDestruction(deletionQueue, frameNumber, indirectBuffer->buffer.buffer, &indirectBuffer->buffer.allocation);
+        free(indirectBuffer->sliceVersions);
+        createIndirectDrawBuffer(allocator, capacity, sliceCount, indirectBuffer);
+    }
+
+    if (indirectBuffer->sliceVersions[slice] == drawList->version)
+        return 0;
 
-    copyDataToDeviceMemory(device, *indexBufferMemory, indices, indexBufferSize);
+    uint64_t size = sizeof(VkDrawIndexedIndirectCommand) * drawList->drawCount;
+    writeFrameSlice(allocator, &indirectBuffer->buffer, slice, drawList->draws, size);
+    indirectBuffer->sliceVersions[slice] = drawList->version;
+    return size;
 }
 
 void createModelMatricesForGridArray(InstanceData *instanceData, uint32_t instanceCount)
@@ -1036,13 +1220,22 @@ void createModelMatricesForGridArray(InstanceData *instanceData, uint32_t instan
     }
 }
 
-void addInstance(VkDevice device, VkPhysicalDevice physicalDevice, Transform transform, VkBuffer *instanceBuffer, VkDeviceMemory *instanceBufferMemory, InstanceData **instanceData, uint32_t *instanceCount)
+void addInstance(GpuAllocator *allocator, DeletionQueue *deletionQueue, uint64_t frameNumber, Transform transform, FrameSlicedBuffer *instanceBuffer, InstanceData **instanceData, uint32_t *instanceCount, uint32_t *instanceCapacity)
 {
     *instanceCount += 1;
-    int bufferSize = sizeof(InstanceData) * (*instanceCount);
 
-    // Reallocate instanceData with the new size
-    *instanceData = realloc(*instanceData, bufferSize);
+    // capacity doubles on the cpu and gpu side together, so adding n instances costs O(log n) reallocations
+    bool grow = *instanceCount > *instanceCapacity;
+    if (grow)
+    {
+        *instanceCapacity *= 2;
+        *instanceData = realloc(*instanceData, sizeof(InstanceData) * (*instanceCapacity));
+        if (!*instanceData)
+        {
+            fprintf(stderr, "Failed to grow instance data\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // Calculate the new cube's position in the grid
     int rows = floor(sqrt(*instanceCount - 1)); // Rows of the complete grid before adding new cube
@@ -1066,17 +1259,13 @@ void addInstance(VkDevice device, VkPhysicalDevice physicalDevice, Transform tra
     vec3 additionalTranslation = {transform.translateX, transform.translateY, 0.0f};
     glm_translate((*instanceData)[newCubeIndex].model, additionalTranslation);
 
-    // Destroy old buffer and create a new one with updated size
-    vkDeviceWaitIdle(device); // Wait for the device to be idle before destroying and reallocating
-    vkDestroyBuffer(device, *instanceBuffer, NULL);
-    vkFreeMemory(device, *instanceBufferMemory, NULL);
-    createBuffer(device, physicalDevice, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, instanceBuffer, instanceBufferMemory);
-
-    // Map the new buffer and copy the instance data into it
-    void *data;
-    vkMapMemory(device, *instanceBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, *instanceData, bufferSize);
-    vkUnmapMemory(device, *instanceBufferMemory);
+    // Retire the old buffer (frames in flight may still read it) and create a bigger one, no device wide stall
+    if (grow)
+    {
+        uint32_t sliceCount = instanceBuffer->sliceCount;
+        deferBufferDestruction(deletionQueue, frameNumber, instanceBuffer->buffer, &instanceBuffer->allocation);
+        createInstanceBuffer(allocator, *instanceData, *instanceCount, *instanceCapacity, sliceCount, instanceBuffer);
+    }
 }
 
 void removeInstance(InstanceData *instanceData, uint32_t *instanceCount, uint32_t instanceIndexToRemove)
@@ -1097,11 +1286,10 @@ void updateAllInstanceTransformations(InstanceData *instanceData, uint32_t insta
     }
 }
 
-void createSyncObjects(VkDevice device, uint32_t maxFramesInFlight, VkSemaphore **imageAvailableSemaphores, VkSemaphore **renderFinishedSemaphores, VkFence **inFlightFences)
+FrameContext *createFrameContexts(VkDevice device, VkCommandPool commandPool, VkDescriptorSet *descriptorSets, uint32_t maxFramesInFlight)
 {
-    *imageAvailableSemaphores = malloc(sizeof(VkSemaphore) * maxFramesInFlight);
-    *renderFinishedSemaphores = malloc(sizeof(VkSemaphore) * maxFramesInFlight);
-    *inFlightFences = malloc(sizeof(VkFence) * maxFramesInFlight);
+    FrameContext *frames = malloc(sizeof(FrameContext) * maxFramesInFlight);
+    VkCommandBuffer *commandBuffers = allocateCommandBuffers(device, commandPool, maxFramesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo = {0};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1110,15 +1298,123 @@ void createSyncObjects(VkDevice device, uint32_t maxFramesInFlight, VkSemaphore
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Initialize fences in the signaled state
 
-    for (size_t i = 0; i < maxFramesInFlight; i++)
+    for (uint32_t i = 0; i < maxFramesInFlight; i++)
     {
-        if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &((*imageAvailableSemaphores)[i])) != VK_SUCCESS ||
-            vkCreateSemaphore(device, &semaphoreInfo, NULL, &((*renderFinishedSemaphores)[i])) != VK_SUCCESS ||
-            vkCreateFence(device, &fenceInfo, NULL, &((*inFlightFences)[i])) != VK_SUCCESS)
+        frames[i].commandBuffer = commandBuffers[i];
+        frames[i].descriptorSet = descriptorSets[i];
+        frames[i].slice = i;
+
+        if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &frames[i].imageAvailableSemaphore) != VK_SUCCESS ||
+            vkCreateFence(device, &fenceInfo, NULL, &frames[i].inFlightFence) != VK_SUCCESS)
         {
 
             fprintf(stderr, "Failed to create synchronization objects for a frame\n");
             exit(EXIT_FAILURE);
         }
     }
+
+    free(commandBuffers);
+    return frames;
+}
+
+void destroyFrameContexts(VkDevice device, VkCommandPool commandPool, FrameContext *frames, uint32_t maxFramesInFlight)
+{
+    for (uint32_t i = 0; i < maxFramesInFlight; i++)
+    {
+        vkFreeCommandBuffers(device, commandPool, 1, &frames[i].commandBuffer);
+        vkDestroySemaphore(device, frames[i].imageAvailableSemaphore, NULL);
+        vkDestroyFence(device, frames[i].inFlightFence, NULL);
+    }
+    free(frames);
+}
+
+// render finished semaphores belong to the swap chain image: presentation keeps waiting on them until that image comes back
+VkSemaphore *createRenderFinishedSemaphores(VkDevice device, uint32_t swapChainImageCount)
+{
+    VkSemaphore *semaphores = malloc(sizeof(VkSemaphore) * swapChainImageCount);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {0};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < swapChainImageCount; i++)
+    {
+        if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &semaphores[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create render finished semaphore\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return semaphores;
+}
+
+// the swap chain and everything sized by its images, replaced as one unit when the window changes
+typedef struct
+{
+    VkSwapchainKHR swapChain;
+    VkExtent2D extent;
+    uint32_t imageCount;
+    VkImageView *imageViews;
+    VkFramebuffer *framebuffers;
+    VkSemaphore *renderFinishedSemaphores; // one per image, see createRenderFinishedSemaphores
+} SwapchainData;
+
+SwapchainData createSwapchainData(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, VkFormat imageFormat, VkRenderPass renderPass, VkSwapchainKHR oldSwapChain, VkExtent2D fallbackExtent)
+{
+    SwapchainData swapchain = {0};
+    swapchain.swapChain = createSwapChain(physicalDevice, device, surface, oldSwapChain, fallbackExtent, &swapchain.extent);
+    swapchain.imageViews = createImageViews(device, swapchain.swapChain, imageFormat, &swapchain.imageCount);
+    swapchain.framebuffers = createFramebuffers(device, swapchain.imageViews, swapchain.imageCount, swapchain.extent, renderPass);
+    swapchain.renderFinishedSemaphores = createRenderFinishedSemaphores(device, swapchain.imageCount);
+    return swapchain;
+}
+
+// hands a replaced swap chain to the deletion queue instead of waiting for the device to go idle,
+// frames still in flight keep rendering into (and presenting) its images until they retire
+void retireSwapchainData(DeletionQueue *deletionQueue, uint64_t frameNumber, SwapchainData *swapchain)
+{
+    for (uint32_t i = 0; i < swapchain->imageCount; i++)
+    {
+        deferFramebufferDestruction(deletionQueue, frameNumber, swapchain->framebuffers[i]);
+        deferImageViewDestruction(deletionQueue, frameNumber, swapchain->imageViews[i]);
+        deferSemaphoreDestruction(deletionQueue, frameNumber, swapchain->renderFinishedSemaphores[i]);
+    }
+    deferSwapchainDestruction(deletionQueue, frameNumber, swapchain->swapChain);
+
+    free(swapchain->framebuffers);
+    free(swapchain->imageViews);
+    free(swapchain->renderFinishedSemaphores);
+    *swapchain = (SwapchainData){0};
+}
+
+// rebuilds the swap chain for the window's current size, the old one is passed as oldSwapchain and retired.
+// returns false while the window is minimized (zero sized), the current swap chain is kept untouched then
+bool recreateSwapchainData(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, GLFWwindow *window, VkFormat imageFormat, VkRenderPass renderPass, DeletionQueue *deletionQueue, uint64_t frameNumber, SwapchainData *swapchain)
+{
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    if (width == 0 || height == 0)
+        return false;
+
+    VkExtent2D fallbackExtent = {(uint32_t)width, (uint32_t)height};
+    SwapchainData oldSwapchain = *swapchain;
+    *swapchain = createSwapchainData(physicalDevice, device, surface, imageFormat, renderPass, oldSwapchain.swapChain, fallbackExtent);
+    retireSwapchainData(deletionQueue, frameNumber, &oldSwapchain);
+
+    return true;
+}
+
+void destroySwapchainData(VkDevice device, SwapchainData *swapchain)
+{
+    for (uint32_t i = 0; i < swapchain->imageCount; i++)
+    {
+        vkDestroyFramebuffer(device, swapchain->framebuffers[i], NULL);
+        vkDestroyImageView(device, swapchain->imageViews[i], NULL);
+        vkDestroySemaphore(device, swapchain->renderFinishedSemaphores[i], NULL);
+    }
+    vkDestroySwapchainKHR(device, swapchain->swapChain, NULL);
+
+    free(swapchain->framebuffers);
+    free(swapchain->imageViews);
+    free(swapchain->renderFinishedSemaphores);
+    *swapchain = (SwapchainData){0};
 }
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE // clock_gettime, sysconf and friends stay visible under -std=c11 on glibc
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +13,31 @@
 #include "mymath.c"
 #include "myglfw.c"
 #include "mygltf.c"
+#include "myassets.c"
 #include "helpers.c"
+#include "mystats.c"
+#include "myreplay.c"
 #include "../include/structure.h"
 
-int main()
+int main(int argc, char **argv)
 {
+    AppOptions options = parseAppOptions(argc, argv);
+
+    // --trace records every scope from here on, the gpu timeline needs the profiler's timestamp queries
+    if (options.tracePath)
+        enableTracing();
+
+    // --record logs key changes per frame, --replay plays them back on a fixed timestep for as many frames as were recorded
+    InputRecorder *inputRecorder = NULL;
+    if (options.replayPath)
+    {
+        inputRecorder = loadInputReplay(options.replayPath);
+        if (options.frameCount == 0)
+            options.frameCount = (uint32_t)inputRecorder->frameCount;
+    }
+    else if (options.recordPath)
+        inputRecorder = createInputRecorder(options.recordPath);
+    double timestep = options.timestepMs > 0.0 ? options.timestepMs / 1000.0 : INPUT_REPLAY_DEFAULT_TIMESTEP;
 
     // initialization/creation process to the end:
     // initialize_window => vulkan_instance => vulkan_surface => physical_device => find_graphics_queue_family_index (not really init/creation) => logical_device => choose_swap_surface_format (not really init/creation) => swap_chain => image_views => render_pass => load shaders (frag+vert) (not really init) => ubo initialization / descriptor setting  => graphics_pipeline =>  frame_buffers => command_buffers => command_pool => vertex_buffer => instace_buffer => sync_objects => instance buffer (model matrices) => view_buffer => projection_buffer => index_buffer =>  main_loop => cleanup
@@ -28,37 +50,59 @@ int main()
 
     VkQueue graphicsQueue, presentQueue;
 
-    uint32_t swapChainImageCount;
-
-    VkExtent2D swapChainExtent;
-
     // enumerateVulkanExtensions(); // to figure out all extensions available on the system
 
     // Initialize GLFW Window, WindowData struct with the created window handle
 
     UserData *userData = createUserData(initialWindowWidth, initialWindowHeight); // used for key press handling and window resizing
 
-    GLFWwindow *window = createWindow(initialWindowWidth, initialWindowHeight);
+    // headless runs (ci, perf boxes without a display) never touch glfw, they render into offscreen images
+    GLFWwindow *window = NULL;
+    VkInstance instance;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+    if (options.headless)
+    {
+        instance = createHeadlessVulkanInstance();
+        if (options.frameCount == 0)
+            options.frameCount = HEADLESS_DEFAULT_FRAME_COUNT;
+    }
+    else
+    {
+        window = createWindow(initialWindowWidth, initialWindowHeight);
 
 // we are creating the vulkan instance for windows os with its associated extensions
-    VkInstance instance = createVulkanInstanceWIN64();
+        instance = createVulkanInstanceWIN64();
 
-    VkSurfaceKHR surface = createSurface(instance, window);
+        surface = createSurface(instance, window);
+    }
 
     // enumeratePhysicalDevices(instance);
 
     VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
 
     uint32_t graphicsQueueFamilyIndex = findGraphicsQueueFamilyIndex(physicalDevice);
+    uint32_t transferQueueFamilyIndex = findTransferQueueFamilyIndex(physicalDevice, graphicsQueueFamilyIndex);
+
+    VkQueue transferQueue;
+    VkDevice device = createLogicalDevice(physicalDevice, graphicsQueueFamilyIndex, transferQueueFamilyIndex, !options.headless, &graphicsQueue, &presentQueue, &transferQueue);
 
-    VkDevice device = createLogicalDevice(physicalDevice, graphicsQueueFamilyIndex, &graphicsQueue, &presentQueue);
+    // every buffer below is sub-allocated out of a few big memory blocks
+    GpuAllocator *allocator = createGpuAllocator(device, physicalDevice);
 
-    VkSurfaceFormatKHR chosenFormat = chooseSwapSurfaceFormat(physicalDevice, surface);
-    VkSwapchainKHR swapChain = createSwapChain(physicalDevice, device, surface, &swapChainExtent);
+    VkSurfaceFormatKHR chosenFormat = {HEADLESS_FORMAT, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    if (!options.headless)
+        chosenFormat = chooseSwapSurfaceFormat(physicalDevice, surface);
 
-    VkImageView *swapChainImageViews = createImageViews(device, swapChain, chosenFormat.format, &swapChainImageCount);
+    VkImageLayout finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkRenderPass renderPass = createRenderPass(device, chosenFormat.format, finalLayout);
 
-    VkRenderPass renderPass = createRenderPass(device, chosenFormat.format);
+    // swap chain, image views, framebuffers and present semaphores, rebuilt together whenever the window changes
+    VkExtent2D initialExtent = {initialWindowWidth, initialWindowHeight};
+    SwapchainData swapchain = {0};
+    OffscreenTarget offscreenTarget = {0};
+    if (!options.headless)
+        swapchain = createSwapchainData(physicalDevice, device, surface, chosenFormat.format, renderPass, VK_NULL_HANDLE, initialExtent);
 
     size_t vertexShaderSize, fragmentShaderSize;
 
@@ -67,26 +111,54 @@ int main()
     char *vertexShaderCode = loadShaderCode("./shaders/vertex_shader.spv", &vertexShaderSize);
     char *fragmentShaderCode = loadShaderCode("./shaders/fragment_shader.spv", &fragmentShaderSize);
 
+    // per frame resources are sized by frames in flight, not by swap chain images
+    const uint32_t MAX_FRAMES_IN_FLIGHT = 3; // 3 for full triple buffering potential
+
+    // headless frames render into one offscreen image per frame in flight instead of swap chain images
+    if (options.headless)
+        offscreenTarget = createOffscreenTarget(allocator, renderPass, initialExtent, MAX_FRAMES_IN_FLIGHT);
+    VkExtent2D renderExtent = options.headless ? offscreenTarget.extent : swapchain.extent;
+
     // Unified buffer object setup (do not mistake the uniform buffer with the vertex buffer and the layout descriptor with the attribute and binding descriptor)
 
-    VkBuffer uniformBuffers[10000];
-    VkDeviceMemory uniformBufferMemory[10000]; // created as an array but used in update as an item of said array
-    createUniformBuffers(device, physicalDevice, swapChainImageCount, uniformBuffers, uniformBufferMemory);
+    FrameSlicedBuffer uniformBuffer; // one persistently mapped buffer, one slice per frame in flight
+    createUniformBuffers(allocator, MAX_FRAMES_IN_FLIGHT, &uniformBuffer);
 
     VkDescriptorSetLayout descriptorSetLayout = createDescriptorSetLayout(device);
-    VkDescriptorPool descriptorPool = createDescriptorPool(device, swapChainImageCount);
-    VkDescriptorSet *descriptorSets = createDescriptorSets(device, descriptorPool, descriptorSetLayout, uniformBuffers, swapChainImageCount);
+    VkDescriptorPool descriptorPool = createDescriptorPool(device, MAX_FRAMES_IN_FLIGHT);
+    VkDescriptorSet *descriptorSets = createDescriptorSets(device, descriptorPool, descriptorSetLayout, &uniformBuffer, MAX_FRAMES_IN_FLIGHT);
 
     // pipeline layout creation and and actual pipeline creation (note the descriptor for bindings and attributes not the same as layout descriptor)
 
     VkPipelineLayout pipelineLayout = createPipelineLayout(device, &descriptorSetLayout, 1);
-    VkPipeline graphicsPipeline = createGraphicsPipeline(device, swapChainExtent, renderPass, pipelineLayout, vertexShaderCode, vertexShaderSize, fragmentShaderCode, fragmentShaderSize);
+    // driver compiled pipelines are kept on disk between runs, only a cold start compiles shaders from scratch
+    PipelineCache pipelineCache = loadPipelineCache(device, physicalDevice, PIPELINE_CACHE_PATH);
+
+    // vertex input descriptions come from the layout every mesh is packed in, the cube and the model share it
+    VertexFormat vertexFormat = getVertexFormat(options.quantizePositions);
+
+    double pipelineStartTime = getTimeSeconds();
+    VkPipeline graphicsPipeline = createGraphicsPipeline(device, pipelineCache.cache, renderPass, pipelineLayout, &vertexFormat, vertexShaderCode, vertexShaderSize, fragmentShaderCode, fragmentShaderSize);
+    reportPipelineCacheTime(&pipelineCache, getTimeSeconds() - pipelineStartTime);
 
     // Framebuffers, Command Pool, Command Buffers, Vertex Buffer, Synchronization Objects
 
-    VkFramebuffer *swapChainFramebuffers = createFramebuffers(device, swapChainImageViews, swapChainImageCount, swapChainExtent, renderPass);
     VkCommandPool commandPool = createCommandPool(device, graphicsQueueFamilyIndex);
-    VkCommandBuffer *commandBuffers = allocateCommandBuffers(device, commandPool, swapChainImageCount);
+
+    // command buffer, descriptor set, buffer slices and sync objects grouped per frame in flight
+    FrameContext *frames = createFrameContexts(device, commandPool, descriptorSets, MAX_FRAMES_IN_FLIGHT);
+
+    // draws are recorded into per thread secondary command buffers once there are enough of them
+    CommandRecorder *commandRecorder = createCommandRecorder(device, graphicsQueueFamilyIndex, options.threadCount, MAX_FRAMES_IN_FLIGHT);
+
+    // --profile times the main loop stages on the cpu and the frame on the gpu, NULL turns every scope into a no-op
+    Profiler *profiler = options.profile || options.tracePath ? createProfiler(device, physicalDevice, graphicsQueueFamilyIndex, MAX_FRAMES_IN_FLIGHT) : NULL;
+
+    // all static geometry is copied into device local buffers through this ring
+    StagingRing *stagingRing = createStagingRing(allocator, graphicsQueueFamilyIndex, graphicsQueue, STAGING_RING_DEFAULT_SIZE);
+
+    // scene load time covers parsing, extraction and copying into the staging ring, the gpu copy runs with the first frame
+    double loadStart = getTimeSeconds();
 
     // vertex buffers, index buffers -- FOR CUBES --
     const Vertex *cubeVertices;
@@ -97,25 +169,36 @@ int main()
     uint32_t cubeIndexCount; //needs for recordCommandBuffers
     createCubeIndexData(&cubeIndices, &cubeIndexCount);
 
-    VkBuffer cubeVertexBuffer, cubeIndexBuffer;
-    VkDeviceMemory cubeVertexBufferMemory, cubeIndexBufferMemory;
-
-    createVertexBuffer(device, physicalDevice, cubeVertices, cubeVertexCount, &cubeVertexBuffer, &cubeVertexBufferMemory);
-    createIndexBuffer(device, physicalDevice, cubeIndices, cubeIndexCount, &cubeIndexBuffer, &cubeIndexBufferMemory);
+    DrawRange cubeRange = {0, cubeIndexCount, 0, VK_INDEX_TYPE_UINT16};
+    Mesh cubeMesh;
+    createMesh(allocator, stagingRing, options.quantizePositions, cubeVertices, cubeVertexCount, cubeIndices, cubeIndexCount, NULL, 0, &cubeRange, 1, &cubeMesh);
 
     // vertex buffers, index buffers -- FOR GLTF MODELS --
-    
-    VkBuffer gltfVertexBuffer, gltfIndexBuffer;
-    VkDeviceMemory gltfIndexBufferMemory, gltfVertexBufferMemory;
-    uint32_t gltfIndexCount = loadGltfMeshes("./gltfs/testScene.gltf", device, physicalDevice, &gltfVertexBuffer, &gltfVertexBufferMemory, &gltfIndexBuffer, &gltfIndexBufferMemory);
-    
-    // semaphore, fence and sync objects
-    const int MAX_FRAMES_IN_FLIGHT = 3; // 3 for full triple buffering potential
-    VkSemaphore *imageAvailableSemaphores;
-    VkSemaphore *renderFinishedSemaphores;
-    VkFence *inFlightFences;
-
-    createSyncObjects(device, MAX_FRAMES_IN_FLIGHT, &imageAvailableSemaphores, &renderFinishedSemaphores, &inFlightFences);
+    // --model cube skips the gltf and draws the cube instead, a cooked scene.gltf.mesh is picked over scene.gltf
+    bool drawCubes = strcmp(options.modelPath, "cube") == 0;
+    Mesh gltfMesh = {0};
+    bool gltfLoaded = false;
+
+    // windowed runs draw the cube until the loader thread hands the model over. headless runs measure a synchronous load,
+    // replays load synchronously too so every frame of a recording draws the same thing on every machine
+    AssetLoader *assetLoader = NULL;
+    if (!drawCubes && !options.headless && !options.syncLoad && !options.replayPath && transferQueue != VK_NULL_HANDLE)
+    {
+        assetLoader = createAssetLoader(allocator, transferQueueFamilyIndex, transferQueue, graphicsQueueFamilyIndex, 0);
+        requestModelLoad(assetLoader, options.modelPath, options.verboseLoad, options.quantizePositions);
+    }
+    else if (!drawCubes)
+    {
+        loadModel(options.modelPath, options.verboseLoad, options.quantizePositions, commandRecorder->threadPool, allocator, stagingRing, &gltfMesh);
+        gltfLoaded = true;
+    }
+
+    const Mesh *sceneMesh = gltfLoaded ? &gltfMesh : &cubeMesh;
+
+    double loadSeconds = getTimeSeconds() - loadStart;
+    uint64_t loadPeakRssBytes = getPeakRssBytes();
+    printf("scene load: %.2f ms, peak rss %.1f MB (%s%s)\n", loadSeconds * 1000.0, loadPeakRssBytes / (1024.0 * 1024.0), options.modelPath,
+           assetLoader ? ", loading in the background" : "");
 
     // projection setup
     // Example of camera parameters
@@ -126,15 +209,31 @@ int main()
     // Models matrices (within instanceData)
 
     // Create an instance buffer
-    VkBuffer instanceBuffer;
-    VkDeviceMemory instanceBufferMemory;
-    uint32_t instanceCount = 1;
+    FrameSlicedBuffer instanceBuffer; // one slice per frame in flight so we never write what the gpu is reading
+    uint32_t instanceCount = options.instanceCount > 0 ? options.instanceCount : options.drawCount > 0 ? options.drawCount : 1;
+    uint32_t instanceCapacity = instanceCount > 64 ? instanceCount : 64; // doubles whenever addInstance runs out of room
 
-    InstanceData *instanceData = malloc(sizeof(InstanceData) * instanceCount);
+    InstanceData *instanceData = malloc(sizeof(InstanceData) * instanceCapacity);
 
     createModelMatricesForGridArray(instanceData, instanceCount);
 
-    createInstanceBuffer(device, physicalDevice, instanceData, instanceCount, &instanceBuffer, &instanceBufferMemory);
+    createInstanceBuffer(allocator, instanceData, instanceCount, instanceCapacity, MAX_FRAMES_IN_FLIGHT, &instanceBuffer);
+
+    // --draws n splits the instances into one draw call each, used to measure recording cost against draw count
+    bool drawPerInstance = options.drawCount > 0;
+    DrawList drawList = {0};
+
+    // the draw list goes to the gpu and each index type is one vkCmdDrawIndexedIndirect, however many primitives
+    bool indirectDraws = !options.directDraws && supportsIndirectDraws(physicalDevice);
+    IndirectDrawBuffer indirectBuffer = {0};
+    if (indirectDraws)
+        createIndirectDrawBuffer(allocator, sceneMesh->rangeCount * (drawPerInstance ? instanceCount : 1), MAX_FRAMES_IN_FLIGHT, &indirectBuffer);
+    printf("draws: %s\n", indirectDraws ? "indirect" : "direct");
+
+    // buffers replaced while frames are in flight wait here until those frames are done
+    DeletionQueue deletionQueue = {0};
+
+    printGpuAllocatorStats(allocator);
 
     // View matrix
     mat4 view;
@@ -142,33 +241,62 @@ int main()
 
     // Projection matrix
     mat4 projection;
-    float aspectRatio = swapChainExtent.width / (float)swapChainExtent.height;
+    float aspectRatio = renderExtent.width / (float)renderExtent.height;
     createProjectionMatrix(projection, 45.0f, aspectRatio, 0.1f, 10.0f);
 
     // Set the glfw callbacks
-    glfwSetKeyCallback(window, keyCallback);
-    glfwSetWindowUserPointer(window, userData);
+    if (!options.headless)
+    {
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetWindowUserPointer(window, userData);
+    }
 
     // Initialize the Transform struct
     Transform transform = {
         .translateX = 0.0f,
         .translateY = 0.0f};
 
-    // calc fps
-    double lastTime = glfwGetTime();
-    int numFrames;
+    // frame time percentiles and hitches are printed once a second, --csv streams every frame
+    FrameStats *frameStats = createFrameStats(options.hitchThresholdMs, options.csvPath);
+    double startTime = getTimeSeconds(); // the clock works without glfw, times below are relative to this
+    double lastTime = 0.0;
+    double lastProfilerReport = lastTime;
+    VkDeviceSize lastUploadedBytes = stagingRing->uploadedBytes;
+    int traceKeyWasDown = 0;
+
+    // --frames n (always set when headless) ends the run after n frames and prints frame time statistics
+    double *frameTimes = options.frameCount > 0 ? malloc(sizeof(double) * options.frameCount) : NULL;
+    double lastFrameEnd = 0.0;
 
     // Main loop
-    size_t currentFrame = 0; // used for buffer synchronization
+    uint32_t currentFrame = 0; // picks the FrameContext, used for buffer synchronization
+    uint64_t frameNumber = 0; // never wraps, used to tell when retired resources are safe to destroy
 
-    while (!glfwWindowShouldClose(window))
+    while ((options.frameCount == 0 || frameNumber < options.frameCount) && (options.headless || !glfwWindowShouldClose(window)))
     {
+        double frameScope = beginCpuScope(profiler, PROFILE_FRAME);
 
-        glfwPollEvents(); // poll early for early inputs (like key presses) before render process. this may make the user experience better
+        double scope = beginCpuScope(profiler, PROFILE_POLL);
+        if (!options.headless)
+            glfwPollEvents(); // poll early for early inputs (like key presses) before render process. this may make the user experience better
 
-        double currentTime = glfwGetTime();
+        processInputFrame(inputRecorder, frameNumber, &userData->keyStates);
+        endCpuScope(profiler, PROFILE_POLL, scope);
 
-        printFPS(&numFrames, &lastTime, currentTime);
+        double currentTime = getTimeSeconds() - startTime;
+        double simulationTime = options.replayPath ? frameNumber * timestep : currentTime; // replays never see the wall clock
+
+        if (currentTime - lastTime >= 1.0)
+        {
+            printFrameStats(frameStats);
+            printCommandRecorderStats(commandRecorder);
+            lastTime = currentTime;
+        }
+        if (options.profile && currentTime - lastProfilerReport >= PROFILER_REPORT_INTERVAL)
+        {
+            printProfilerReport(profiler);
+            lastProfilerReport = currentTime;
+        }
       
 
 
@@ -188,7 +316,11 @@ int main()
                 removeInstance(instanceData, &instanceCount, instanceCount - 1);
 
         if (userData->keyStates.keySpacePressed)
-            addInstance(device, physicalDevice, transform, &instanceBuffer, &instanceBufferMemory, &instanceData, &instanceCount); // adds to instance count no need to do this elsewhere
+        {
+            traceBegin("addInstance");
+            addInstance(allocator, &deletionQueue, frameNumber, transform, &instanceBuffer, &instanceData, &instanceCount, &instanceCapacity); // adds to instance count no need to do this elsewhere
+            traceEnd("addInstance");
+        }
 
         if (userData->keyStates.key1Pressed)
             updateAllInstanceTransformations(instanceData, instanceCount, 1.02); // Update all instances
@@ -196,6 +328,7 @@ int main()
         if (userData->keyStates.key2Pressed)
             updateAllInstanceTransformations(instanceData, instanceCount, 0.98); // Update all instances
 
+        scope = beginCpuScope(profiler, PROFILE_TRANSFORM_UPDATE);
         applyFriction(&transform, 0.3f);
 
         vec3 translation = {transform.translateX, transform.translateY, 0.0f}; // Only translate in X and Y
@@ -204,112 +337,264 @@ int main()
         {
             glm_translate(instanceData[i].model, translation);
         }
+        endCpuScope(profiler, PROFILE_TRANSFORM_UPDATE, scope);
 
-        // 0. Wait for the previous frame to finish
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        FrameContext *frame = &frames[currentFrame];
 
-        // 1. Acquire an image from the swap chain
-        uint32_t imageIndex;
-        vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        // 0. Wait until the gpu is done with this frame context, after that all of its resources are ours again
+        scope = beginCpuScope(profiler, PROFILE_FENCE_WAIT);
+        vkWaitForFences(device, 1, &frame->inFlightFence, VK_TRUE, UINT64_MAX);
+        endCpuScope(profiler, PROFILE_FENCE_WAIT, scope);
 
-        handleWindowResize(userData, &projection);
+        // the timestamps this frame context wrote MAX_FRAMES_IN_FLIGHT frames ago are final now
+        collectGpuFrame(profiler, currentFrame);
 
-        updateUniformBuffer(device, uniformBufferMemory[imageIndex], currentTime, view, projection); // will need to modify this
+        // the fence we just waited on belongs to frame (frameNumber - MAX_FRAMES_IN_FLIGHT), everything up to it is done
+        if (frameNumber >= MAX_FRAMES_IN_FLIGHT)
+            flushDeletionQueue(&deletionQueue, allocator, frameNumber - MAX_FRAMES_IN_FLIGHT);
+
+        // 1. Acquire an image from the swap chain, the image index only picks the framebuffer and the present semaphore
+        uint32_t imageIndex = currentFrame; // offscreen images belong to the frame context
+        VkResult acquireResult = VK_SUCCESS;
+        scope = beginCpuScope(profiler, PROFILE_ACQUIRE);
+        if (!options.headless)
+            acquireResult = vkAcquireNextImageKHR(device, swapchain.swapChain, UINT64_MAX, frame->imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+        endCpuScope(profiler, PROFILE_ACQUIRE, scope);
+
+        if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            // nothing was acquired and the fence is still signalled, rebuild and try again next iteration
+            traceBegin("recreate swapchain");
+            if (!recreateSwapchainData(physicalDevice, device, surface, window, chosenFormat.format, renderPass, &deletionQueue, frameNumber, &swapchain))
+                glfwWaitEvents(); // minimized, sleep until the window comes back
+            else
+                updateProjectionForExtent(projection, swapchain.extent);
+            traceEnd("recreate swapchain");
+            endCpuScope(profiler, PROFILE_FRAME, frameScope);
+            continue;
+        }
+        if (acquireResult != VK_SUCCESS && acquireResult != VK_SUBOPTIMAL_KHR)
+        {
+            fprintf(stderr, "Failed to acquire swap chain image\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // reset only once we know this frame will be submitted
+        vkResetFences(device, 1, &frame->inFlightFence);
+
+        // a finished background load replaces the placeholder from this frame on, its buffers are taken over from the
+        // transfer family in the staging batch that is submitted ahead of the draws
+        LoadedModel loadedModel;
+        if (assetLoader && pollLoadedModel(assetLoader, &loadedModel))
+        {
+            gltfMesh = loadedModel.mesh;
+            gltfLoaded = true;
+            stagingRingAcquireBuffer(stagingRing, gltfMesh.vertexBuffer, transferQueueFamilyIndex);
+            stagingRingAcquireBuffer(stagingRing, gltfMesh.indexBuffer, transferQueueFamilyIndex);
+            sceneMesh = &gltfMesh;
+            printf("model ready after %.2f ms in the background (%s)\n", loadedModel.seconds * 1000.0, loadedModel.path);
+        }
+
+        // writes go straight into the persistent mappings, no map/unmap per frame. the uniform buffer carries the position
+        // quantization of the mesh drawn this frame
+        scope = beginCpuScope(profiler, PROFILE_BUFFER_UPDATE);
+        updateUniformBuffer(allocator, &uniformBuffer, frame->slice, simulationTime, view, projection, &sceneMesh->positionQuantization);
+
+        updateInstanceBuffer(allocator, &instanceBuffer, frame->slice, instanceData, instanceCount);
+        endCpuScope(profiler, PROFILE_BUFFER_UPDATE, scope);
+
+        uint64_t indirectBytes = 0;
+        DrawState drawState = {0};
+        drawState.renderPass = renderPass;
+        drawState.framebuffer = options.headless ? offscreenTarget.framebuffers[imageIndex] : swapchain.framebuffers[imageIndex];
+        drawState.extent = options.headless ? offscreenTarget.extent : swapchain.extent;
+        drawState.pipeline = graphicsPipeline;
+        drawState.pipelineLayout = pipelineLayout;
+        drawState.descriptorSet = frame->descriptorSet;
+        drawState.vertexBuffer = sceneMesh->vertexBuffer;
+        drawState.indexBuffer = sceneMesh->indexBuffer;
+        drawState.indexOffsets[0] = sceneMesh->indexOffsets[0];
+        drawState.indexOffsets[1] = sceneMesh->indexOffsets[1];
+        drawState.instanceBuffer = instanceBuffer.buffer;
+        drawState.instanceBufferOffset = getFrameSliceOffset(&instanceBuffer, frame->slice);
+        updateDrawList(&drawList, sceneMesh->ranges, sceneMesh->rangeCount, instanceCount, drawPerInstance); // no-op unless the instance count changed
+        drawState.draws = drawList.draws;
+        drawState.drawCount = drawList.drawCount;
+        drawState.uint16DrawCount = drawList.uint16DrawCount;
+        drawState.drawListVersion = drawList.version;
+        if (indirectDraws)
+        {
+            indirectBytes = updateIndirectDrawBuffer(allocator, &deletionQueue, frameNumber, &indirectBuffer, frame->slice, &drawList);
+            drawState.indirectBuffer = indirectBuffer.buffer.buffer;
+            drawState.indirectBufferOffset = getFrameSliceOffset(&indirectBuffer.buffer, frame->slice);
+        }
 
-        updateInstanceBuffer(device, instanceBufferMemory, instanceData, instanceCount);
+        scope = beginCpuScope(profiler, PROFILE_RECORD);
+        recordFrameCommands(commandRecorder, currentFrame, frame->commandBuffer, &drawState, profiler);
+        endCpuScope(profiler, PROFILE_RECORD, scope);
+        // uploads recorded this frame go out as one fenced batch ahead of the draw, finished batches give their ring space back
+        stagingRingSubmit(stagingRing);
+        stagingRingCollect(stagingRing);
 
-        recordCommandBuffers(commandBuffers, imageIndex, renderPass, swapChainExtent, swapChainFramebuffers, graphicsPipeline, gltfVertexBuffer, gltfIndexBuffer, instanceBuffer, gltfIndexCount, instanceCount, descriptorSets, pipelineLayout);
         // 2. Submit the command buffer
         VkSubmitInfo submitInfo = {0};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+        // nothing to wait for or signal offscreen, the fence alone orders the frames
+        VkSemaphore waitSemaphores[] = {frame->imageAvailableSemaphore};
         VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.waitSemaphoreCount = options.headless ? 0 : 1;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
         submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+        submitInfo.pCommandBuffers = &frame->commandBuffer;
 
-        VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-        submitInfo.signalSemaphoreCount = 1;
+        VkSemaphore signalSemaphores[] = {options.headless ? VK_NULL_HANDLE : swapchain.renderFinishedSemaphores[imageIndex]};
+        submitInfo.signalSemaphoreCount = options.headless ? 0 : 1;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+        scope = beginCpuScope(profiler, PROFILE_SUBMIT);
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame->inFlightFence) != VK_SUCCESS)
         {
             fprintf(stderr, "Failed to submit draw command buffer\n");
             exit(EXIT_FAILURE);
         }
+        endCpuScope(profiler, PROFILE_SUBMIT, scope);
 
-        // 3. Present the image
-        VkPresentInfoKHR presentInfo = {0};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        // 3. Present the image (headless frames stay in their offscreen image)
+        if (!options.headless)
+        {
+            VkPresentInfoKHR presentInfo = {0};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = signalSemaphores;
+
+            VkSwapchainKHR swapChains[] = {swapchain.swapChain};
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = swapChains;
+            presentInfo.pImageIndices = &imageIndex;
+
+            scope = beginCpuScope(profiler, PROFILE_PRESENT);
+            VkResult presentResult = vkQueuePresentKHR(presentQueue, &presentInfo);
+            endCpuScope(profiler, PROFILE_PRESENT, scope);
+
+            // a suboptimal or lost swap chain (or a resize the surface has not reported yet) is rebuilt right away,
+            // the old one is retired through the deletion queue so nothing waits for the device to go idle
+            if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR || acquireResult == VK_SUBOPTIMAL_KHR || userData->windowData.wasResized)
+            {
+                traceBegin("recreate swapchain");
+                if (recreateSwapchainData(physicalDevice, device, surface, window, chosenFormat.format, renderPass, &deletionQueue, frameNumber, &swapchain))
+                {
+                    updateProjectionForExtent(projection, swapchain.extent);
+                    userData->windowData.wasResized = false;
+                }
+                traceEnd("recreate swapchain");
+            }
+            else if (presentResult != VK_SUCCESS)
+            {
+                fprintf(stderr, "Failed to present swap chain image\n");
+                exit(EXIT_FAILURE);
+            }
+        }
 
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
+        // frame time is the distance between consecutive frame ends, fence waits included
+        double frameEnd = getTimeSeconds() - startTime;
+        if (frameTimes)
+            frameTimes[frameNumber] = frameEnd - lastFrameEnd;
 
-        VkSwapchainKHR swapChains[] = {swapChain};
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = swapChains;
-        presentInfo.pImageIndices = &imageIndex;
+        // uniforms and instances go through the persistent mappings every frame, anything else through the staging ring
+        uint64_t bytesUploaded = sizeof(UBO) + (uint64_t)instanceCount * sizeof(InstanceData) + indirectBytes + (stagingRing->uploadedBytes - lastUploadedBytes);
+        lastUploadedBytes = stagingRing->uploadedBytes;
+        recordFrameStats(frameStats, frameEnd - lastFrameEnd, instanceCount, drawList.drawCount, bytesUploaded);
+        lastFrameEnd = frameEnd;
+        endCpuScope(profiler, PROFILE_FRAME, frameScope);
 
-        vkQueuePresentKHR(presentQueue, &presentInfo);
+        // T dumps what the rings hold right now, between frames while the recording threads are idle
+        if (options.tracePath && userData->keyStates.keyTPressed && !traceKeyWasDown)
+            writeTrace(options.tracePath);
+        traceKeyWasDown = userData->keyStates.keyTPressed;
 
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        frameNumber++;
     }
 
     // Clean up
 
+    // the loader thread submits to its own queue, it has to be gone before the device can be waited on
+    if (assetLoader)
+        destroyAssetLoader(assetLoader);
+
     // Wait for the logical device to finish operations before cleanup
     vkDeviceWaitIdle(device);
 
-    // Cleanup: Synchronization objects
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    if (frameTimes)
+    {
+        FrameTimeSummary summary = summarizeFrameTimes(frameTimes, (uint32_t)frameNumber, lastFrameEnd);
+        printFrameTimeSummary(&summary);
+        if (options.resultsPath)
+            writeRunResults(options.resultsPath, &summary, loadSeconds, loadPeakRssBytes, instanceCount, drawList.drawCount, frameStats->hitchCount,
+                            (uint64_t)sceneMesh->vertexCount * sceneMesh->vertexStride, getGpuAverageSeconds(profiler, PROFILE_MAIN_PASS));
+        free(frameTimes);
+    }
+    printf("%llu hitches over %.1f ms in %llu frames\n", (unsigned long long)frameStats->hitchCount,
+           frameStats->hitchThreshold * 1000.0, (unsigned long long)frameStats->totalFrames);
+    destroyFrameStats(frameStats);
+    if (inputRecorder)
+        destroyInputRecorder(inputRecorder);
+
+    if (profiler)
     {
-        vkDestroySemaphore(device, renderFinishedSemaphores[i], NULL);
-        vkDestroySemaphore(device, imageAvailableSemaphores[i], NULL);
-        vkDestroyFence(device, inFlightFences[i], NULL);
+        // every frame is done after the wait, pick up the ones still in flight before the last report
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            collectGpuFrame(profiler, i);
+        }
+        if (options.profile)
+            printProfilerReport(profiler);
+        destroyProfiler(profiler);
     }
-    free(renderFinishedSemaphores);
-    free(imageAvailableSemaphores);
-    free(inFlightFences);
 
     // Cleanup: Instance Buffer
 
-    vkDestroyBuffer(device, instanceBuffer, NULL);    // Destroy the instance buffer
-    vkFreeMemory(device, instanceBufferMemory, NULL); // Free the memory used by the instance buffer
+    destroyFrameSlicedBuffer(allocator, &instanceBuffer); // Destroy the instance buffer and release its memory range
+    if (indirectDraws)
+        destroyIndirectDrawBuffer(allocator, &indirectBuffer);
+    destroyDeletionQueue(&deletionQueue, allocator);      // anything still retired is safe to destroy after vkDeviceWaitIdle
     free(instanceData);
 
-    // Cleanup: Command Buffers and Command Pool
-    vkFreeCommandBuffers(device, commandPool, swapChainImageCount, commandBuffers);
-    free(commandBuffers);
-    vkDestroyCommandPool(device, commandPool, NULL);
+    // Cleanup: recording threads and their command pools
+    destroyCommandRecorder(commandRecorder);
 
-    // Cleanup: Framebuffers
-    for (uint32_t i = 0; i < swapChainImageCount; i++)
+    // the gpu ranges of the last frames were collected above, the recording threads are joined
+    if (options.tracePath)
     {
-        vkDestroyFramebuffer(device, swapChainFramebuffers[i], NULL);
+        writeTrace(options.tracePath);
+        destroyTracing();
     }
-    free(swapChainFramebuffers);
+    destroyDrawList(&drawList);
+
+    // Cleanup: Frame contexts (command buffers, per frame sync objects) and Command Pool
+    destroyFrameContexts(device, commandPool, frames, MAX_FRAMES_IN_FLIGHT);
+    free(descriptorSets);
+    vkDestroyCommandPool(device, commandPool, NULL);
+
+    // Cleanup: staging ring
+    destroyStagingRing(stagingRing);
 
     // Cleanup: Vertex and Index Buffer and its associated memory
-    vkDestroyBuffer(device, cubeVertexBuffer, NULL);
-    vkDestroyBuffer(device, cubeIndexBuffer, NULL);
-    vkFreeMemory(device, cubeIndexBufferMemory, NULL);
-    vkFreeMemory(device, cubeVertexBufferMemory, NULL);
+    destroyMesh(allocator, &cubeMesh);
+    if (gltfLoaded)
+        destroyMesh(allocator, &gltfMesh);
 
-    vkDestroyBuffer(device, gltfVertexBuffer, NULL);
-    vkFreeMemory(device, gltfVertexBufferMemory, NULL);
-    vkDestroyBuffer(device, gltfIndexBuffer, NULL);
-    vkFreeMemory(device, gltfIndexBufferMemory, NULL);
-    
 
     // Cleanup: Shader Modules, Pipeline, Render Pass, Image Views, Swap Chain
     free(vertexShaderCode);
     free(fragmentShaderCode);
     vkDestroyPipeline(device, graphicsPipeline, NULL);
+    savePipelineCache(device, &pipelineCache, PIPELINE_CACHE_PATH);
+    destroyPipelineCache(device, &pipelineCache);
     vkDestroyPipelineLayout(device, pipelineLayout, NULL);
     vkDestroyRenderPass(device, renderPass, NULL);
 
@@ -317,28 +602,30 @@ int main()
     vkDestroyDescriptorPool(device, descriptorPool, NULL);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
 
-    for (uint32_t i = 0; i < swapChainImageCount; i++)
-    {
-        vkDestroyBuffer(device, uniformBuffers[i], NULL);
-        vkFreeMemory(device, uniformBufferMemory[i], NULL);
-    }
+    destroyFrameSlicedBuffer(allocator, &uniformBuffer);
 
-    for (uint32_t i = 0; i < swapChainImageCount; i++)
-    {
-        vkDestroyImageView(device, swapChainImageViews[i], NULL);
-    }
-    free(swapChainImageViews);
-    vkDestroySwapchainKHR(device, swapChain, NULL);
+    // Cleanup: Framebuffers, Image Views, present semaphores and the Swap Chain (retired ones went with the deletion queue)
+    if (options.headless)
+        destroyOffscreenTarget(allocator, &offscreenTarget);
+    else
+        destroySwapchainData(device, &swapchain);
+
+    // Cleanup: gpu memory blocks (every buffer has to be destroyed by now)
+    destroyGpuAllocator(allocator);
 
     // Cleanup: Logical Device, Surface, Vulkan Instance
     vkDestroyDevice(device, NULL);
-    vkDestroySurfaceKHR(instance, surface, NULL);
+    if (surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(instance, surface, NULL);
     vkDestroyInstance(instance, NULL);
 
     // cleanup: glfw
     free(userData);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (window)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 
     return 0;
 }
@@ -0,0 +1,302 @@
+// benchmark driver: runs the app headless over fixed scenarios, collects the json each run writes with --results,
+// writes all of them to benchmark_results.json and compares p95 frame time and load time against a baseline.
+// exits 1 when a scenario regressed by more than the tolerance, so it can gate ci. scenarios with a reference (the
+// same scene with an app option switched on, or a differently cooked mesh) also print their p95, vertex memory and,
+// when both ran with --profile, gpu render pass time against that scenario's run.
+//
+//   make benchmark                                     build the linux app and the driver, run every scenario
+//   ./benchmark --update-baseline                      store this machine's results as the new baseline
+//   ./benchmark --only cubes --tolerance 0.05          scenarios whose name contains "cubes", 5% tolerance
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CGLTF_IMPLEMENTATION
+#include "../include/cgltf.h"
+
+#define BENCHMARK_DEFAULT_APP "./vulkanapp-linux"
+#define BENCHMARK_RESULTS_PATH "benchmark_results.json"
+#define BENCHMARK_BASELINE_PATH "tests/benchmark_baseline.json"
+#define BENCHMARK_RUN_PATH "benchmark_run.json"
+#define BENCHMARK_DEFAULT_TOLERANCE 0.10
+#define BENCHMARK_NOISE_FLOOR_MS 0.10 // differences below this never count as regressions
+#define BENCHMARK_LINE_LENGTH 1024
+
+typedef struct
+{
+    const char *name;
+    const char *model; // gltf path or "cube"
+    uint32_t instances;
+    uint32_t frames;
+    const char *options;   // extra app options, "" for none
+    const char *reference; // scenario this one is compared against, NULL for none
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"cubes_1", "cube", 1, 1000, "", NULL},
+    {"cubes_100", "cube", 100, 1000, "", NULL},
+    {"cubes_10k", "cube", 10000, 500, "", NULL},
+    {"cubes_100k", "cube", 100000, 200, "", NULL},
+    {"cubes_1m", "cube", 1000000, 60, "", NULL},
+    {"lambo", "./gltfs/lambo_sto/scene.gltf", 1, 300, "", NULL},
+    {"lambo_grid_64", "./gltfs/lambo_sto/scene.gltf", 64, 100, "", NULL},
+    {"testscene_grid_10k", "./gltfs/testScene.gltf", 10000, 500, "", NULL},
+    {"lambo_quantized", "./gltfs/lambo_sto/scene.gltf", 1, 300, "--quantize-positions", "lambo"},
+    {"lambo_grid_64_quantized", "./gltfs/lambo_sto/scene.gltf", 64, 100, "--quantize-positions", "lambo_grid_64"},
+    // file order against ./cooker --optimize (src/mymeshopt.c), the gpu pass time is what the reordering changes
+    {"lambo_grid_64_profiled", "./gltfs/lambo_sto/scene.gltf", 64, 100, "--profile", NULL},
+    {"lambo_grid_64_optimized", "./gltfs/lambo_sto/scene.optimized.mesh", 64, 100, "--profile", "lambo_grid_64_profiled"},
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+// value of "key": in a one line json object, false when it is not there
+static bool readJsonNumber(const char *line, const char *key, double *value)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *found = strstr(line, pattern);
+    if (!found)
+        return false;
+
+    char *end;
+    *value = strtod(found + strlen(pattern), &end);
+    return end != found + strlen(pattern);
+}
+
+// the line of path whose "scenario" is name
+static bool findScenarioLine(const char *path, const char *name, char *line)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    char pattern[128];
+    snprintf(pattern, sizeof(pattern), "\"scenario\":\"%s\"", name);
+
+    bool found = false;
+    while (!found && fgets(line, BENCHMARK_LINE_LENGTH, file))
+    {
+        found = strstr(line, pattern) != NULL;
+    }
+    fclose(file);
+    return found;
+}
+
+static bool fileExists(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file)
+        fclose(file);
+    return file != NULL;
+}
+
+// a gltf can be in the tree without the buffers it points at (gltfs/lambo_sto has no scene.bin), such scenarios are
+// skipped instead of failing. false when everything the model needs is there, otherwise missing names the first file that is not
+static bool findMissingModelFile(const char *model, char *missing, size_t missingSize)
+{
+    if (strcmp(model, "cube") == 0)
+        return false;
+    snprintf(missing, missingSize, "%s", model);
+    if (!fileExists(model))
+        return true;
+
+    cgltf_options options = {0};
+    cgltf_data *data = NULL;
+    size_t length = strlen(model);
+    if (length < 5 || strcmp(model + length - 5, ".gltf") != 0 || cgltf_parse_file(&options, model, &data) != cgltf_result_success)
+        return false; // cooked meshes are self contained, a broken gltf fails its run
+
+    const char *slash = strrchr(model, '/');
+    int directoryLength = slash ? (int)(slash - model + 1) : 0;
+    bool found = false;
+    for (size_t i = 0; i < data->buffers_count && !found; i++)
+    {
+        const char *uri = data->buffers[i].uri;
+        if (!uri || strncmp(uri, "data:", 5) == 0)
+            continue;
+        int pathLength = snprintf(missing, missingSize, "%.*s%s", directoryLength, model, uri);
+        found = pathLength >= 0 && (size_t)pathLength < missingSize && !fileExists(missing);
+    }
+    cgltf_free(data);
+    return found;
+}
+
+// runs one scenario, returns its results line with the scenario name in front
+static bool runScenario(const char *app, const Scenario *scenario, char *line)
+{
+    char command[1024];
+    int commandLength = snprintf(command, sizeof(command), "%s --headless --frames %u --model %s --instances %u %s --results %s > /dev/null",
+                                 app, scenario->frames, scenario->model, scenario->instances, scenario->options, BENCHMARK_RUN_PATH);
+    if (commandLength < 0 || (size_t)commandLength >= sizeof(command))
+    {
+        fprintf(stderr, "%s: command line too long\n", scenario->name);
+        return false;
+    }
+
+    remove(BENCHMARK_RUN_PATH);
+    int status = system(command);
+
+    char runLine[BENCHMARK_LINE_LENGTH];
+    FILE *file = fopen(BENCHMARK_RUN_PATH, "r");
+    bool ok = status == 0 && file && fgets(runLine, sizeof(runLine), file) && runLine[0] == '{';
+    if (file)
+        fclose(file);
+    remove(BENCHMARK_RUN_PATH);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: run failed (%s)\n", scenario->name, command);
+        return false;
+    }
+
+    // a cut off line is broken json, treat it like a failed run
+    runLine[strcspn(runLine, "\n")] = '\0';
+    int lineLength = snprintf(line, BENCHMARK_LINE_LENGTH, "{\"scenario\":\"%s\",\"model\":\"%s\",%s", scenario->name, scenario->model, runLine + 1);
+    if (lineLength < 0 || lineLength >= BENCHMARK_LINE_LENGTH)
+    {
+        fprintf(stderr, "%s: results line longer than %d bytes\n", scenario->name, BENCHMARK_LINE_LENGTH);
+        return false;
+    }
+    return true;
+}
+
+// true when current is worse than baseline by more than the tolerance and the noise floor
+static bool regressed(const char *scenario, const char *key, const char *current, const char *baseline, double tolerance)
+{
+    double now, before;
+    if (!readJsonNumber(current, key, &now) || !readJsonNumber(baseline, key, &before))
+        return false;
+
+    bool worse = now > before * (1.0 + tolerance) && now - before > BENCHMARK_NOISE_FLOOR_MS;
+    printf("  %-20s %-8s %10.3f ms  baseline %10.3f ms  %+6.1f%%%s\n", scenario, key, now, before,
+           before > 0.0 ? (now / before - 1.0) * 100.0 : 0.0, worse ? "  REGRESSION" : "");
+    return worse;
+}
+
+// a scenario against the run of its reference scenario from this same invocation
+static void compareWithReference(const Scenario *scenario, const char *current, const char *reference)
+{
+    double now, before, vertexMb, referenceVertexMb;
+    if (readJsonNumber(current, "p95_ms", &now) && readJsonNumber(reference, "p95_ms", &before))
+        printf("  vs %-24s p95      %10.3f ms  %-8s %10.3f ms  %+6.1f%%\n", scenario->reference, now, "was", before,
+               before > 0.0 ? (now / before - 1.0) * 100.0 : 0.0);
+    if (readJsonNumber(current, "vertex_mb", &vertexMb) && readJsonNumber(reference, "vertex_mb", &referenceVertexMb))
+        printf("  vs %-24s vertices %10.3f MB  %-8s %10.3f MB  %+6.1f%%\n", scenario->reference, vertexMb, "was", referenceVertexMb,
+               referenceVertexMb > 0.0 ? (vertexMb / referenceVertexMb - 1.0) * 100.0 : 0.0);
+    if (readJsonNumber(current, "gpu_pass_ms", &now) && readJsonNumber(reference, "gpu_pass_ms", &before) && now > 0.0 && before > 0.0)
+        printf("  vs %-24s gpu pass %10.3f ms  %-8s %10.3f ms  %+6.1f%%\n", scenario->reference, now, "was", before, (now / before - 1.0) * 100.0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *app = BENCHMARK_DEFAULT_APP;
+    const char *baselinePath = BENCHMARK_BASELINE_PATH;
+    const char *only = NULL;
+    double tolerance = BENCHMARK_DEFAULT_TOLERANCE;
+    bool updateBaseline = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--app") == 0 && i + 1 < argc)
+            app = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--update-baseline") == 0)
+            updateBaseline = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--app path] [--baseline file] [--only name] [--tolerance 0.1] [--update-baseline]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *results = fopen(BENCHMARK_RESULTS_PATH, "w");
+    if (!results)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", BENCHMARK_RESULTS_PATH);
+        return EXIT_FAILURE;
+    }
+
+    bool hasBaseline = !updateBaseline && fileExists(baselinePath);
+    uint32_t failures = 0;
+    uint32_t regressions = 0;
+
+    // every run's line, for the scenarios that compare against another one
+    static char lines[SCENARIO_COUNT][BENCHMARK_LINE_LENGTH];
+
+    fprintf(results, "[\n");
+    bool first = true;
+    for (size_t i = 0; i < SCENARIO_COUNT; i++)
+    {
+        const Scenario *scenario = &scenarios[i];
+        if (only && !strstr(scenario->name, only))
+            continue;
+
+        char missing[BENCHMARK_LINE_LENGTH];
+        if (findMissingModelFile(scenario->model, missing, sizeof(missing)))
+        {
+            printf("%s: skipped, %s is missing\n", scenario->name, missing);
+            continue;
+        }
+
+        printf("%s: %u instances of %s, %u frames%s%s\n", scenario->name, scenario->instances, scenario->model, scenario->frames,
+               scenario->options[0] ? ", " : "", scenario->options);
+
+        char *line = lines[i];
+        if (!runScenario(app, scenario, line))
+        {
+            failures++;
+            continue;
+        }
+
+        fprintf(results, "%s%s", first ? "" : ",\n", line);
+        first = false;
+
+        char baseline[BENCHMARK_LINE_LENGTH];
+        if (hasBaseline && findScenarioLine(baselinePath, scenario->name, baseline))
+        {
+            regressions += regressed(scenario->name, "p95_ms", line, baseline, tolerance);
+            regressions += regressed(scenario->name, "load_ms", line, baseline, tolerance);
+        }
+        else
+        {
+            double p95 = 0.0, load = 0.0;
+            readJsonNumber(line, "p95_ms", &p95);
+            readJsonNumber(line, "load_ms", &load);
+            printf("  p95 %.3f ms, load %.3f ms%s\n", p95, load, hasBaseline ? " (not in baseline)" : "");
+        }
+
+        for (size_t j = 0; j < i && scenario->reference; j++)
+        {
+            if (strcmp(scenarios[j].name, scenario->reference) == 0 && lines[j][0] == '{')
+                compareWithReference(scenario, line, lines[j]);
+        }
+    }
+    fprintf(results, "\n]\n");
+    fclose(results);
+
+    if (updateBaseline)
+    {
+        // the baseline is the results file as is, one scenario per line
+        if (rename(BENCHMARK_RESULTS_PATH, baselinePath) != 0)
+        {
+            fprintf(stderr, "Failed to move %s to %s\n", BENCHMARK_RESULTS_PATH, baselinePath);
+            return EXIT_FAILURE;
+        }
+        printf("baseline written to %s\n", baselinePath);
+    }
+    else if (!hasBaseline)
+        printf("no baseline at %s, run with --update-baseline to create one\n", baselinePath);
+
+    printf("results in %s: %u failed runs, %u regressions over %.0f%%\n", updateBaseline ? baselinePath : BENCHMARK_RESULTS_PATH,
+           failures, regressions, tolerance * 100.0);
+    return failures > 0 || regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
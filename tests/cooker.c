@@ -0,0 +1,226 @@
+// mesh cooker: converts a gltf into the cooked mesh format of src/mymeshfile.c, which the app maps and uploads
+// without parsing any json. lays the primitives out exactly like loadGltfMeshes does (one shared buffer of packed
+// vertices, primitives with at most 65536 vertices get 16-bit indices) and adds per primitive bounds and material indices.
+// like the loader it skips primitives without vec3 positions and fails on primitives without indices, it also fails on
+// indices past a primitive's vertices. nothing is written when it fails.
+// --optimize reorders the triangles and vertices of every triangle list primitive (src/mymeshopt.c) and prints the
+// vertex cache acmr/atvr before and after, the draw ranges stay the same.
+//
+//   make cooker && ./cooker gltfs/lambo_sto/scene.gltf       writes gltfs/lambo_sto/scene.gltf.mesh
+//   ./cooker scene.gltf out.mesh                              somewhere else, load it with --model out.mesh
+//   ./cooker --optimize scene.gltf scene.optimized.mesh       optimized, next to the file order one for comparing
+
+#define _DEFAULT_SOURCE
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CGLTF_IMPLEMENTATION
+#include "../include/cgltf.h"
+#include "../src/mymeshfile.c"
+#include "../src/mymeshopt.c"
+
+// set 0 of an attribute, only when it has one element per position
+static const cgltf_accessor *findAttribute(const cgltf_primitive *primitive, cgltf_attribute_type type, cgltf_type accessorType, size_t count)
+{
+    for (size_t i = 0; i < primitive->attributes_count; i++)
+    {
+        const cgltf_accessor *accessor = primitive->attributes[i].data;
+        if (primitive->attributes[i].type == type && primitive->attributes[i].index == 0)
+            return accessor->type == accessorType && (count == 0 || accessor->count == count) ? accessor : NULL;
+    }
+    return NULL;
+}
+
+static const cgltf_accessor *findPositions(const cgltf_primitive *primitive)
+{
+    return findAttribute(primitive, cgltf_attribute_type_position, cgltf_type_vec3, 0);
+}
+
+static void growBounds(float *boundsMin, float *boundsMax, const float *position)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        boundsMin[axis] = position[axis] < boundsMin[axis] ? position[axis] : boundsMin[axis];
+        boundsMax[axis] = position[axis] > boundsMax[axis] ? position[axis] : boundsMax[axis];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool optimize = argc > 1 && strcmp(argv[1], "--optimize") == 0;
+    int first = optimize ? 2 : 1;
+    if (argc - first < 1 || argc - first > 2)
+    {
+        fprintf(stderr, "usage: %s [--optimize] input.gltf [output.mesh]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *inputPath = argv[first];
+    char outputPath[1024];
+    snprintf(outputPath, sizeof(outputPath), "%s%s", inputPath, MESH_FILE_EXTENSION);
+    if (argc - first == 2)
+        snprintf(outputPath, sizeof(outputPath), "%s", argv[first + 1]);
+
+    cgltf_options options = {0};
+    cgltf_data *data = NULL;
+    if (cgltf_parse_file(&options, inputPath, &data) != cgltf_result_success ||
+        cgltf_load_buffers(&options, data, inputPath) != cgltf_result_success)
+    {
+        fprintf(stderr, "Failed to load %s\n", inputPath);
+        return EXIT_FAILURE;
+    }
+
+    // count first, every array is allocated once
+    MeshFileHeader header = {0};
+    for (size_t i = 0; i < data->meshes_count; i++)
+    {
+        for (size_t j = 0; j < data->meshes[i].primitives_count; j++)
+        {
+            const cgltf_primitive *primitive = &data->meshes[i].primitives[j];
+            const cgltf_accessor *positions = findPositions(primitive);
+            if (positions == NULL)
+            {
+                fprintf(stderr, "Primitive %zu of mesh %zu has no vec3 positions, skipping it\n", j, i);
+                continue;
+            }
+            if (primitive->indices == NULL)
+            {
+                fprintf(stderr, "Primitive %zu of mesh %zu has no indices, not writing %s\n", j, i, outputPath);
+                return EXIT_FAILURE;
+            }
+
+            if (positions->count <= (size_t)UINT16_MAX + 1)
+                header.indexCount16 += primitive->indices->count;
+            else
+                header.indexCount32 += primitive->indices->count;
+            header.vertexCount += positions->count;
+            header.rangeCount++;
+        }
+    }
+
+    Vertex *vertices = malloc(sizeof(Vertex) * (header.vertexCount > 0 ? header.vertexCount : 1));
+    uint16_t *indices16 = malloc(sizeof(uint16_t) * (header.indexCount16 > 0 ? header.indexCount16 : 1));
+    uint32_t *indices32 = malloc(sizeof(uint32_t) * (header.indexCount32 > 0 ? header.indexCount32 : 1));
+    MeshFileRange *ranges = malloc(sizeof(MeshFileRange) * (header.rangeCount > 0 ? header.rangeCount : 1));
+    uint32_t *primitiveIndices = malloc(sizeof(uint32_t) * (header.indexCount16 + header.indexCount32 > 0 ? header.indexCount16 + header.indexCount32 : 1));
+    if (!vertices || !indices16 || !indices32 || !ranges || !primitiveIndices)
+    {
+        fprintf(stderr, "Failed to allocate the geometry of %s\n", inputPath);
+        return EXIT_FAILURE;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        header.boundsMin[axis] = FLT_MAX;
+        header.boundsMax[axis] = -FLT_MAX;
+    }
+
+    uint64_t vertexCount = 0, indexCount16 = 0, indexCount32 = 0;
+    uint32_t rangeCount = 0;
+    uint32_t optimizedCount = 0;
+    VertexCacheStats before = {0}, after = {0};
+    for (size_t i = 0; i < data->meshes_count; i++)
+    {
+        for (size_t j = 0; j < data->meshes[i].primitives_count; j++)
+        {
+            const cgltf_primitive *primitive = &data->meshes[i].primitives[j];
+            const cgltf_accessor *positions = findPositions(primitive);
+            if (positions == NULL)
+                continue;
+
+            // offline, so cgltf's generic readers are fast enough for every accessor layout
+            const cgltf_accessor *normals = findAttribute(primitive, cgltf_attribute_type_normal, cgltf_type_vec3, positions->count);
+            const cgltf_accessor *tangents = findAttribute(primitive, cgltf_attribute_type_tangent, cgltf_type_vec4, positions->count);
+            const cgltf_accessor *texcoords = findAttribute(primitive, cgltf_attribute_type_texcoord, cgltf_type_vec2, positions->count);
+            Vertex *primitiveVertices = vertices + vertexCount;
+            for (size_t k = 0; k < positions->count; k++)
+            {
+                Vertex *vertex = &primitiveVertices[k];
+                float values[4];
+                packVertexDefaults(vertex);
+                cgltf_accessor_read_float(positions, k, vertex->inPosition, 3);
+                if (normals && cgltf_accessor_read_float(normals, k, values, 3))
+                    packNormal(values, vertex->inNormal);
+                if (tangents && cgltf_accessor_read_float(tangents, k, values, 4))
+                    packTangent(values, vertex->inTangent);
+                if (texcoords && cgltf_accessor_read_float(texcoords, k, values, 2))
+                {
+                    vertex->inUv[0] = packHalf(values[0]);
+                    vertex->inUv[1] = packHalf(values[1]);
+                }
+            }
+
+            MeshFileRange *range = &ranges[rangeCount++];
+            range->indexCount = (uint32_t)primitive->indices->count;
+            range->vertexOffset = (int32_t)vertexCount;
+            range->material = primitive->material ? (int32_t)(primitive->material - data->materials) : -1;
+            range->indexSize = positions->count <= (size_t)UINT16_MAX + 1 ? sizeof(uint16_t) : sizeof(uint32_t);
+            range->firstIndex = (uint32_t)(range->indexSize == sizeof(uint16_t) ? indexCount16 : indexCount32);
+
+            // an index past the primitive's vertices would be narrowed or point into the next primitive, no file then
+            size_t indexCount = primitive->indices->count;
+            for (size_t k = 0; k < indexCount; k++)
+            {
+                primitiveIndices[k] = (uint32_t)cgltf_accessor_read_index(primitive->indices, k);
+                if (primitiveIndices[k] >= positions->count)
+                {
+                    fprintf(stderr, "Primitive %zu of mesh %zu: index %zu is %u but there are only %zu vertices, not writing %s\n", j, i, k,
+                            primitiveIndices[k], positions->count, outputPath);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            // triangle lists only, the passes reorder whole triangles
+            if (optimize && primitive->type == cgltf_primitive_type_triangles && indexCount % 3 == 0)
+            {
+                analyzeVertexCache(primitiveIndices, indexCount, positions->count, &before);
+                optimizeMesh(primitiveIndices, indexCount, primitiveVertices, positions->count);
+                analyzeVertexCache(primitiveIndices, indexCount, positions->count, &after);
+                optimizedCount++;
+            }
+
+            for (size_t k = 0; k < indexCount; k++)
+            {
+                if (range->indexSize == sizeof(uint16_t))
+                    indices16[indexCount16++] = (uint16_t)primitiveIndices[k];
+                else
+                    indices32[indexCount32++] = primitiveIndices[k];
+            }
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                range->boundsMin[axis] = FLT_MAX;
+                range->boundsMax[axis] = -FLT_MAX;
+            }
+            for (size_t k = 0; k < positions->count; k++)
+            {
+                growBounds(range->boundsMin, range->boundsMax, primitiveVertices[k].inPosition);
+            }
+            growBounds(header.boundsMin, header.boundsMax, range->boundsMin);
+            growBounds(header.boundsMin, header.boundsMax, range->boundsMax);
+
+            vertexCount += positions->count;
+        }
+    }
+
+    bool written = writeMeshFile(outputPath, header, vertices, indices16, indices32, ranges);
+    if (written)
+        printf("cooked %s into %s: %u ranges, %llu vertices, %llu indices (%llu 16-bit)\n", inputPath, outputPath, header.rangeCount,
+               (unsigned long long)header.vertexCount, (unsigned long long)(header.indexCount16 + header.indexCount32),
+               (unsigned long long)header.indexCount16);
+    if (written && optimize)
+        printf("optimized %u of %u ranges: acmr %.3f -> %.3f, atvr %.3f -> %.3f (fifo cache of %u vertices)\n", optimizedCount,
+               header.rangeCount, getAcmr(&before), getAcmr(&after), getAtvr(&before), getAtvr(&after), MESH_OPT_CACHE_SIZE);
+
+    free(vertices);
+    free(indices16);
+    free(indices32);
+    free(ranges);
+    free(primitiveIndices);
+    cgltf_free(data);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}